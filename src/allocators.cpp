@@ -64,3 +64,45 @@ bool MemoryPageLocker::Unlock(const void* addr, size_t len)
 LockedPageManager::LockedPageManager() : LockedPageManagerBase<MemoryPageLocker>(GetSystemPageSize())
 {
 }
+
+CPoolResource::CPoolResource() : pos(NULL), end(NULL), nNextChunkSize(MIN_CHUNK_SIZE), nChunkBytes(0), nFreeBytes(0)
+{
+    memset(vFree, 0, sizeof(vFree));
+}
+
+CPoolResource::~CPoolResource()
+{
+    for (unsigned int i = 0; i < vChunks.size(); i++)
+        ::operator delete(vChunks[i]);
+}
+
+void* CPoolResource::Allocate(size_t nBytes)
+{
+    size_t nUnits = (nBytes + POOL_ALIGN - 1) / POOL_ALIGN;
+    if (vFree[nUnits] != NULL) {
+        void* p = vFree[nUnits];
+        vFree[nUnits] = *static_cast<void**>(p);
+        nFreeBytes -= nUnits * POOL_ALIGN;
+        return p;
+    }
+    if ((size_t)(end - pos) < nUnits * POOL_ALIGN) {
+        // What is left of the current chunk goes unused
+        pos = static_cast<char*>(::operator new(nNextChunkSize));
+        end = pos + nNextChunkSize;
+        vChunks.push_back(pos);
+        nChunkBytes += nNextChunkSize;
+        if (nNextChunkSize < MAX_CHUNK_SIZE)
+            nNextChunkSize *= 2;
+    }
+    void* p = pos;
+    pos += nUnits * POOL_ALIGN;
+    return p;
+}
+
+void CPoolResource::Deallocate(void* p, size_t nBytes)
+{
+    size_t nUnits = (nBytes + POOL_ALIGN - 1) / POOL_ALIGN;
+    *static_cast<void**>(p) = vFree[nUnits];
+    vFree[nUnits] = p;
+    nFreeBytes += nUnits * POOL_ALIGN;
+}
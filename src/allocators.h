@@ -259,6 +259,107 @@ struct zero_after_free_allocator : public std::allocator<T> {
     }
 };
 
+/**
+ * Memory for many small allocations, carved out of larger chunks and recycled
+ * through a free list per size (in steps of POOL_ALIGN bytes). This saves
+ * the per allocation overhead and churn of malloc for containers like the
+ * coins cache, whose nodes all have the same size. Chunks start small and
+ * grow up to MAX_CHUNK_SIZE, and are only returned to the system when the
+ * pool is destroyed.
+ *
+ * Not thread safe: meant to be owned by a single container.
+ */
+class CPoolResource
+{
+public:
+    //! Allocations larger than this are left to the system allocator
+    static const size_t MAX_POOLED_SIZE = 256;
+    //! Alignment (and granularity) of pooled allocations
+    static const size_t POOL_ALIGN = 2 * sizeof(void*);
+    static const size_t MIN_CHUNK_SIZE = 4096;
+    static const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+private:
+    //! Heads of the free lists, indexed by size in POOL_ALIGN units; a free
+    //! allocation holds the pointer to the next one
+    void* vFree[MAX_POOLED_SIZE / POOL_ALIGN + 1];
+    std::vector<char*> vChunks;
+    char* pos;
+    char* end;
+    size_t nNextChunkSize;
+    size_t nChunkBytes;
+    size_t nFreeBytes;
+
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+
+public:
+    CPoolResource();
+    ~CPoolResource();
+
+    static bool IsPooled(size_t nBytes) { return nBytes <= MAX_POOLED_SIZE; }
+
+    void* Allocate(size_t nBytes);
+    void Deallocate(void* p, size_t nBytes);
+
+    //! Bytes taken from the system for chunks
+    size_t MemoryUsage() const { return nChunkBytes; }
+
+    //! Bytes of that in the free lists, which later allocations reuse first
+    size_t FreeMemory() const { return nFreeBytes; }
+};
+
+/**
+ * Allocator taking single elements from a CPoolResource, for node based
+ * containers. Arrays (like a hash table's buckets), elements too large for
+ * the pool, and allocators without a pool use the system allocator.
+ */
+template <typename T>
+struct pool_allocator : public std::allocator<T> {
+    // MSVC8 default copy constructor is broken
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    CPoolResource* pool;
+    pool_allocator() throw() : pool(NULL) {}
+    explicit pool_allocator(CPoolResource* poolIn) throw() : pool(poolIn) {}
+    pool_allocator(const pool_allocator& a) throw() : base(a), pool(a.pool) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) throw() : base(a), pool(a.pool)
+    {
+    }
+    ~pool_allocator() throw() {}
+    template <typename _Other>
+    struct rebind {
+        typedef pool_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        if (pool != NULL && n == 1 && CPoolResource::IsPooled(sizeof(T)))
+            return static_cast<T*>(pool->Allocate(sizeof(T)));
+        return std::allocator<T>::allocate(n, hint);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (pool != NULL && n == 1 && CPoolResource::IsPooled(sizeof(T)))
+            pool->Deallocate(p, sizeof(T));
+        else
+            std::allocator<T>::deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b) { return a.pool == b.pool; }
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b) { return a.pool != b.pool; }
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
@@ -5,10 +5,16 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "utiltime.h"
+
 #include <algorithm>
+#include <assert.h>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -16,7 +22,20 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** What one thread did for a CCheckQueue since its last ResetStats() */
+struct CCheckQueueWorkerStats
+{
+    //! Verifications run (or skipped after a failure)
+    unsigned int nChecks;
+    //! Batches taken from another thread's queue
+    unsigned int nSteals;
+    //! Time spent running verifications
+    int64_t nBusyMicros;
+
+    CCheckQueueWorkerStats() : nChecks(0), nSteals(0), nBusyMicros(0) {}
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,11 +44,24 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread has its own queue with its own lock. The master spreads what
+  * it adds over those queues; a thread takes batches from the back of its
+  * own queue and, once that is empty, steals from the front of the others.
+  * The shared lock is only taken to hand in finished work and to sleep, so
+  * workers don't contend on it while there is work left.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
+    /** The verifications assigned to one thread */
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
     //! Mutex to protect the inner state
     boost::mutex mutex;
 
@@ -39,23 +71,31 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! One queue per thread: the master's at index 0, then the workers' in order of arrival
+    boost::scoped_array<WorkerQueue> vQueues;
+
+    //! Statistics per thread, indexed like vQueues
+    std::vector<CCheckQueueWorkerStats> vStats;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of worker threads (excluding the master) that have registered.
+    unsigned int nWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads vQueues has room for.
+    const unsigned int nMaxWorkers;
+
+    //! The next queue Add() puts work in.
+    unsigned int nNextQueue;
+
+    //! Incremented every time work is added, so idle threads know to look for it.
+    uint64_t nAdded;
 
     //! The temporary evaluation result.
     bool fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
-     * worker's own batches.
+     * This includes elements that are not anymore in a queue, but still in
+     * a thread's own batches or finished but not handed in yet.
      */
     unsigned int nTodo;
 
@@ -65,70 +105,131 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! When the statistics were reset, and when the master last finished waiting
+    int64_t nStatsStartMicros;
+    int64_t nStatsEndMicros;
+
+    /**
+     * Move a batch out of a thread's queue: the newest checks if it is our
+     * own, the oldest if we steal. Take half of what is queued there (up to
+     * nBatchSize), so batches shrink as the queue drains and the rest stays
+     * available to other threads.
+     */
+    bool TakeBatch(WorkerQueue& queue, std::vector<T>& vChecks, bool fOwn)
+    {
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        if (queue.checks.empty())
+            return false;
+        unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.checks.size() / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap rather than copy, to keep the lock short
+            if (fOwn) {
+                vChecks[i].swap(queue.checks.back());
+                queue.checks.pop_back();
+            } else {
+                vChecks[i].swap(queue.checks.front());
+                queue.checks.pop_front();
+            }
+        }
+        return true;
+    }
+
+    /** Drop everything still queued after a failure. Requires mutex to be held. */
+    unsigned int ClearQueues()
+    {
+        unsigned int nCleared = 0;
+        for (unsigned int i = 0; i <= nWorkers; i++) {
+            boost::unique_lock<boost::mutex> lock(vQueues[i].mutex);
+            nCleared += vQueues[i].checks.size();
+            vQueues[i].checks.clear();
+        }
+        return nCleared;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        unsigned int nQueue = 0;
+        unsigned int nQueues;
+        uint64_t nAddedSeen;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fMaster) {
+                assert(nWorkers < nMaxWorkers);
+                nQueue = ++nWorkers;
+            }
+            nQueues = nWorkers + 1;
+            nAddedSeen = nAdded;
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
+        CCheckQueueWorkerStats stats;
         bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+            // Look for work: in our own queue first, then in the others'
+            bool fFound = TakeBatch(vQueues[nQueue], vChecks, true);
+            for (unsigned int i = 1; i < nQueues && !fFound; i++) {
+                fFound = TakeBatch(vQueues[(nQueue + i) % nQueues], vChecks, false);
+                stats.nSteals += fFound;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
+            if (fFound) {
+                // execute work
+                int64_t nStart = GetTimeMicros();
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                stats.nBusyMicros += GetTimeMicros() - nStart;
+                stats.nChecks += vChecks.size();
+                vChecks.clear();
                 if (fOk)
-                    fOk = check();
-            vChecks.clear();
+                    continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Hand in what we did since we last ran out of work
+            nTodo -= stats.nChecks;
+            if (!fOk && fAllOk) {
+                // No need to run the rest
+                fAllOk = false;
+                nTodo -= ClearQueues();
+            }
+            fOk = true;
+            vStats[nQueue].nChecks += stats.nChecks;
+            vStats[nQueue].nSteals += stats.nSteals;
+            vStats[nQueue].nBusyMicros += stats.nBusyMicros;
+            stats = CCheckQueueWorkerStats();
+            if (nTodo == 0 && !fMaster)
+                // We processed the last element; inform the master he can exit and return the result
+                condMaster.notify_one();
+            if (fMaster) {
+                // Nothing left to take, wait for the batches still being run
+                while (nTodo != 0)
+                    cond.wait(lock); // wait
+                bool fRet = fAllOk;
+                // reset the status for new work later
+                fAllOk = true;
+                nStatsEndMicros = GetTimeMicros();
+                // return the current status
+                return fRet;
+            }
+            while (nAddedSeen == nAdded) {
+                if (fQuit)
+                    return fAllOk;
+                cond.wait(lock); // wait
+            }
+            nQueues = nWorkers + 1;
+            nAddedSeen = nAdded;
         } while (true);
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, for at most nMaxWorkersIn threads besides the master
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxWorkersIn) :
+        vQueues(new WorkerQueue[nMaxWorkersIn + 1]), vStats(nMaxWorkersIn + 1), nWorkers(0), nMaxWorkers(nMaxWorkersIn),
+        nNextQueue(0), nAdded(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn),
+        nStatsStartMicros(0), nStatsEndMicros(0) {}
 
     //! Worker thread
     void Thread()
@@ -145,15 +246,37 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        unsigned int nQueues;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Once something failed the result is known, don't bother
+            if (!fAllOk)
+                return;
+            nTodo += vChecks.size();
+            nQueues = nWorkers + 1;
+        }
+
+        // Deal large batches out over all queues, small ones to the next queue in turn
+        unsigned int nChunk = std::max(nBatchSize, (unsigned int)(vChecks.size() + nQueues - 1) / nQueues);
+        unsigned int nChunks = 0;
+        for (unsigned int nPos = 0; nPos < vChecks.size(); nPos += nChunk, nChunks++) {
+            WorkerQueue& queue = vQueues[nNextQueue % nQueues];
+            nNextQueue = (nNextQueue + 1) % nQueues;
+            unsigned int nEnd = std::min((unsigned int)vChecks.size(), nPos + nChunk);
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (unsigned int i = nPos; i < nEnd; i++) {
+                queue.checks.push_back(T());
+                vChecks[i].swap(queue.checks.back());
+            }
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nAdded++;
+        if (nChunks == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -161,15 +284,35 @@ public:
     {
     }
 
+    //! Whether no work is outstanding. Workers may still be looking for more
+    //! after the last Wait(), but will find the queues empty.
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && fAllOk == true);
+    }
+
+    //! Clear the statistics, and start timing from now
+    void ResetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::fill(vStats.begin(), vStats.end(), CCheckQueueWorkerStats());
+        nStatsStartMicros = nStatsEndMicros = GetTimeMicros();
     }
 
+    /**
+     * Statistics per thread since the last ResetStats(), the master first,
+     * and the time from then until the master last finished waiting.
+     */
+    int64_t GetStats(std::vector<CCheckQueueWorkerStats>& vStatsOut)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vStatsOut.assign(vStats.begin(), vStats.begin() + nWorkers + 1);
+        return nStatsEndMicros - nStatsStartMicros;
+    }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -187,6 +330,7 @@ public:
         if (pqueue != NULL) {
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
+            pqueue->ResetStats();
         }
     }
 
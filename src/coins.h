@@ -6,7 +6,9 @@
 #ifndef BITCOIN_COINS_H
 #define BITCOIN_COINS_H
 
+#include "allocators.h"
 #include "compressor.h"
+#include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -256,6 +258,22 @@ public:
                 return false;
         return true;
     }
+
+    //! one bit per output, least significant first, set for the unspent ones
+    void GetUnspentMask(std::vector<unsigned char> &vMask) const {
+        vMask.assign((vout.size() + 7) / 8, 0);
+        for (unsigned int i = 0; i < vout.size(); i++)
+            if (!vout[i].IsNull())
+                vMask[i / 8] |= (1 << (i % 8));
+    }
+
+    //! heap memory used by the outputs and their scripts
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            ret += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&out.scriptPubKey));
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -281,15 +299,31 @@ struct CCoinsCacheEntry
     CCoins coins; // The actual cached data.
     unsigned char flags;
 
+    /**
+     * Which outputs were unspent in the parent view (as CCoins::GetUnspentMask),
+     * and at what height, for DIRTY entries the parent has (not FRESH). A store
+     * that keeps every output separately writes just the ones that changed, as
+     * outputs don't change other than by being spent or unspent, unless the
+     * transaction is spent entirely and then included again at another height.
+     */
+    std::vector<unsigned char> vBaseUnspent;
+    int nBaseHeight;
+
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        USED = (1 << 2), // Looked up or modified since Trim() last passed this entry.
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), nBaseHeight(0) {}
+
+    bool IsBaseUnspent(unsigned int nPos) const {
+        return nPos / 8 < vBaseUnspent.size() && ((vBaseUnspent[nPos / 8] >> (nPos % 8)) & 1);
+    }
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef pool_allocator<std::pair<const uint256, CCoinsCacheEntry> > CCoinsMapAllocator;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -320,8 +354,10 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! If fErase, the passed mapCoins can be modified; otherwise only the coins of
+    //! pruned entries and the unspent masks may be taken, as after a write those
+    //! are of no more use.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
@@ -343,7 +379,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
     bool GetStats(CCoinsStats &stats) const;
 };
 
@@ -360,7 +396,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -381,8 +418,16 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    //! Memory for the nodes of cacheCoins, so it must outlive it
+    CPoolResource cacheResource;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
+    //! The bucket of cacheCoins the next Trim() starts at
+    size_t nTrimBucket;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -392,7 +437,10 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+
+    //! Check whether txid is in this cache, without looking in the base view
+    bool HaveCoinsInCache(const uint256 &txid) const;
 
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
@@ -415,9 +463,30 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep what the cache holds: the entries that remain are clean
+     * afterwards, and stay available without going back to the base.
+     */
+    bool Sync();
+
+    /**
+     * Evict clean entries until the memory they use is down to nTargetUsage,
+     * those not used for the longest time first. Modified entries stay, so
+     * Sync() first to be able to go below their size. Caches on top of this
+     * one must be flushed first, as they count on it keeping what they read.
+     */
+    void Trim(size_t nTargetUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the heap memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
+    //! Like DynamicMemoryUsage(), without the pool memory of erased entries, which new ones reuse
+    size_t DynamicMemoryUsageInUse() const;
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -441,6 +510,13 @@ public:
 private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+
+    //! Start over with an empty pool, handing the memory of an emptied cache back to the system
+    void ReallocateCache();
+
+    //! cacheCoins refers to our own pool, so copies can't share it
+    CCoinsViewCache(const CCoinsViewCache &);
+    CCoinsViewCache& operator=(const CCoinsViewCache &);
 };
 
 #endif // BITCOIN_COINS_H
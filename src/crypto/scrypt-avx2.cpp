@@ -0,0 +1,190 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include "crypto/common.h"
+#include "crypto/scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+
+/*
+ * Each __m256i holds the same 32-bit word of eight independent scrypt
+ * instances, so the Salsa20/8 core below is the scalar xor_salsa8 with every
+ * operand widened to eight lanes.
+ */
+#define ROTL8(a, b) _mm256_or_si256(_mm256_slli_epi32((a), (b)), _mm256_srli_epi32((a), 32 - (b)))
+#define QR8(x, a, b, s) x = _mm256_xor_si256(x, ROTL8(_mm256_add_epi32((a), (b)), (s)))
+
+__attribute__((target("avx2")))
+static inline void xor_salsa8_avx2(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x00,x01,x02,x03,x04,x05,x06,x07,x08,x09,x10,x11,x12,x13,x14,x15;
+	int i;
+
+	x00 = (B[ 0] = _mm256_xor_si256(B[ 0], Bx[ 0]));
+	x01 = (B[ 1] = _mm256_xor_si256(B[ 1], Bx[ 1]));
+	x02 = (B[ 2] = _mm256_xor_si256(B[ 2], Bx[ 2]));
+	x03 = (B[ 3] = _mm256_xor_si256(B[ 3], Bx[ 3]));
+	x04 = (B[ 4] = _mm256_xor_si256(B[ 4], Bx[ 4]));
+	x05 = (B[ 5] = _mm256_xor_si256(B[ 5], Bx[ 5]));
+	x06 = (B[ 6] = _mm256_xor_si256(B[ 6], Bx[ 6]));
+	x07 = (B[ 7] = _mm256_xor_si256(B[ 7], Bx[ 7]));
+	x08 = (B[ 8] = _mm256_xor_si256(B[ 8], Bx[ 8]));
+	x09 = (B[ 9] = _mm256_xor_si256(B[ 9], Bx[ 9]));
+	x10 = (B[10] = _mm256_xor_si256(B[10], Bx[10]));
+	x11 = (B[11] = _mm256_xor_si256(B[11], Bx[11]));
+	x12 = (B[12] = _mm256_xor_si256(B[12], Bx[12]));
+	x13 = (B[13] = _mm256_xor_si256(B[13], Bx[13]));
+	x14 = (B[14] = _mm256_xor_si256(B[14], Bx[14]));
+	x15 = (B[15] = _mm256_xor_si256(B[15], Bx[15]));
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		QR8(x04, x00, x12,  7);  QR8(x09, x05, x01,  7);
+		QR8(x14, x10, x06,  7);  QR8(x03, x15, x11,  7);
+
+		QR8(x08, x04, x00,  9);  QR8(x13, x09, x05,  9);
+		QR8(x02, x14, x10,  9);  QR8(x07, x03, x15,  9);
+
+		QR8(x12, x08, x04, 13);  QR8(x01, x13, x09, 13);
+		QR8(x06, x02, x14, 13);  QR8(x11, x07, x03, 13);
+
+		QR8(x00, x12, x08, 18);  QR8(x05, x01, x13, 18);
+		QR8(x10, x06, x02, 18);  QR8(x15, x11, x07, 18);
+
+		/* Operate on rows. */
+		QR8(x01, x00, x03,  7);  QR8(x06, x05, x04,  7);
+		QR8(x11, x10, x09,  7);  QR8(x12, x15, x14,  7);
+
+		QR8(x02, x01, x00,  9);  QR8(x07, x06, x05,  9);
+		QR8(x08, x11, x10,  9);  QR8(x13, x12, x15,  9);
+
+		QR8(x03, x02, x01, 13);  QR8(x04, x07, x06, 13);
+		QR8(x09, x08, x11, 13);  QR8(x14, x13, x12, 13);
+
+		QR8(x00, x03, x02, 18);  QR8(x05, x04, x07, 18);
+		QR8(x10, x09, x08, 18);  QR8(x15, x14, x13, 18);
+	}
+	B[ 0] = _mm256_add_epi32(B[ 0], x00);
+	B[ 1] = _mm256_add_epi32(B[ 1], x01);
+	B[ 2] = _mm256_add_epi32(B[ 2], x02);
+	B[ 3] = _mm256_add_epi32(B[ 3], x03);
+	B[ 4] = _mm256_add_epi32(B[ 4], x04);
+	B[ 5] = _mm256_add_epi32(B[ 5], x05);
+	B[ 6] = _mm256_add_epi32(B[ 6], x06);
+	B[ 7] = _mm256_add_epi32(B[ 7], x07);
+	B[ 8] = _mm256_add_epi32(B[ 8], x08);
+	B[ 9] = _mm256_add_epi32(B[ 9], x09);
+	B[10] = _mm256_add_epi32(B[10], x10);
+	B[11] = _mm256_add_epi32(B[11], x11);
+	B[12] = _mm256_add_epi32(B[12], x12);
+	B[13] = _mm256_add_epi32(B[13], x13);
+	B[14] = _mm256_add_epi32(B[14], x14);
+	B[15] = _mm256_add_epi32(B[15], x15);
+}
+
+/*
+ * ROMix over eight lanes. V is laid out as V[i][k][lane], so the sequential
+ * fill is a plain vector store; the data dependent reads of the second loop
+ * pick a different row per lane and are done with a gather.
+ */
+__attribute__((target("avx2")))
+static void scrypt_core_avx2(__m256i X[32], __m256i *V)
+{
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32(1023);
+	uint32_t i, k;
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			_mm256_store_si256(&V[i * 32 + k], X[k]);
+		xor_salsa8_avx2(&X[0], &X[16]);
+		xor_salsa8_avx2(&X[16], &X[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Word offset of row j for each lane: j * 32 * 8 + lane. */
+		__m256i idx = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(X[16], mask), 8), lanes);
+		for (k = 0; k < 32; k++) {
+			__m256i v = _mm256_i32gather_epi32((const int *)&V[k], idx, 4);
+			X[k] = _mm256_xor_si256(X[k], v);
+		}
+		xor_salsa8_avx2(&X[0], &X[16]);
+		xor_salsa8_avx2(&X[16], &X[0]);
+	}
+}
+
+__attribute__((target("avx2")))
+void scrypt_1024_1_1_256_sp_avx2(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[SCRYPT_MULTI_WAYS][128];
+	union {
+		__m256i i256[32];
+		uint32_t u32[32][SCRYPT_MULTI_WAYS];
+	} X;
+	__m256i *V;
+	int lane;
+	uint32_t k;
+
+	V = (__m256i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (lane = 0; lane < SCRYPT_MULTI_WAYS; lane++) {
+		const uint8_t *in = (const uint8_t *)input + lane * 80;
+		PBKDF2_SHA256(in, 80, in, 80, 1, B[lane], 128);
+		for (k = 0; k < 32; k++)
+			X.u32[k][lane] = le32dec(&B[lane][4 * k]);
+	}
+
+	scrypt_core_avx2(X.i256, V);
+
+	for (lane = 0; lane < SCRYPT_MULTI_WAYS; lane++) {
+		const uint8_t *in = (const uint8_t *)input + lane * 80;
+		for (k = 0; k < 32; k++)
+			le32enc(&B[lane][4 * k], X.u32[k][lane]);
+		PBKDF2_SHA256(in, 80, B[lane], 128, 1, (uint8_t *)output + lane * 32, 32);
+	}
+}
+__attribute__((target("avx2")))
+void scrypt_core_avx2_8way(uint32_t *X, char *scratchpad)
+{
+	__m256i Xv[32];
+	__m256i *V;
+	uint32_t k;
+
+	V = (__m256i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (k = 0; k < 32; k++)
+		Xv[k] = _mm256_loadu_si256((const __m256i *)&X[k * SCRYPT_MULTI_WAYS]);
+	scrypt_core_avx2(Xv, V);
+	for (k = 0; k < 32; k++)
+		_mm256_storeu_si256((__m256i *)&X[k * SCRYPT_MULTI_WAYS], Xv[k]);
+}
+
+#endif // USE_AVX2
@@ -27,6 +27,7 @@
  * online backup system.
  */
 
+#include "crypto/common.h"
 #include "crypto/scrypt.h"
 //#include "util.h"
 #include <stdlib.h>
@@ -34,7 +35,7 @@
 #include <string.h>
 #include <openssl/sha.h>
 
-#if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
+#if (defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)) || defined(USE_AVX2)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
 #include <intrin.h>
@@ -185,6 +186,31 @@ PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
 	memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
 }
 
+/**
+ * PBKDF2 with a single iteration, starting from an HMAC state already keyed
+ * with the password. The value dkLen must be a multiple of 32.
+ */
+static void
+PBKDF2_SHA256_1(const HMAC_SHA256_CTX *keyctx, const uint8_t *salt,
+    size_t saltlen, uint8_t *buf, size_t dkLen)
+{
+	HMAC_SHA256_CTX PShctx, hctx;
+	size_t i;
+	uint8_t ivec[4];
+
+	memcpy(&PShctx, keyctx, sizeof(HMAC_SHA256_CTX));
+	HMAC_SHA256_Update(&PShctx, salt, saltlen);
+
+	for (i = 0; i * 32 < dkLen; i++) {
+		be32enc(ivec, (uint32_t)(i + 1));
+		memcpy(&hctx, &PShctx, sizeof(HMAC_SHA256_CTX));
+		HMAC_SHA256_Update(&hctx, ivec, 4);
+		HMAC_SHA256_Final(&buf[i * 32], &hctx);
+	}
+
+	memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
+}
+
 #define ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
 
 static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
@@ -253,20 +279,10 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+static void scrypt_core(uint32_t X[32], uint32_t *V)
 {
-	uint8_t B[128];
-	uint32_t X[32];
-	uint32_t *V;
 	uint32_t i, j, k;
 
-	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
-
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
-	for (k = 0; k < 32; k++)
-		X[k] = le32dec(&B[4 * k]);
-
 	for (i = 0; i < 1024; i++) {
 		memcpy(&V[i * 32], X, 128);
 		xor_salsa8(&X[0], &X[16]);
@@ -279,6 +295,23 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 		xor_salsa8(&X[0], &X[16]);
 		xor_salsa8(&X[16], &X[0]);
 	}
+}
+
+void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[128];
+	uint32_t X[32];
+	uint32_t *V;
+	uint32_t k;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+
+	for (k = 0; k < 32; k++)
+		X[k] = le32dec(&B[4 * k]);
+
+	scrypt_core(X, V);
 
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
@@ -322,6 +355,132 @@ void scrypt_detect_sse2()
 }
 #endif
 
+static bool fUseAVX2 = false;
+
+int scrypt_detect_avx2()
+{
+#if defined(USE_AVX2)
+    // AVX2 needs CPUID.7.EBX[5] plus OS support for saving the YMM state (OSXSAVE and XCR0 bits 1 and 2)
+    unsigned int eax, ebx, ecx, edx;
+    fUseAVX2 = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 27)) && __get_cpuid_max(0, NULL) >= 7)
+    {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        fUseAVX2 = (xcr0_lo & 6) == 6 && (ebx & (1 << 5));
+    }
+#endif // USE_AVX2
+    return scrypt_multi_ways();
+}
+
+int scrypt_multi_ways()
+{
+    return fUseAVX2 ? SCRYPT_MULTI_WAYS : 1;
+}
+
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, int nCount)
+{
+#if defined(USE_AVX2)
+    if (fUseAVX2 && nCount > 1)
+    {
+        if (nCount == SCRYPT_MULTI_WAYS) {
+            scrypt_1024_1_1_256_sp_avx2(input, output, scratchpad);
+            return;
+        }
+        // Fill the unused lanes with copies of the last input and drop their results
+        char vInput[SCRYPT_MULTI_WAYS * 80];
+        char vOutput[SCRYPT_MULTI_WAYS * 32];
+        memcpy(vInput, input, nCount * 80);
+        for (int i = nCount; i < SCRYPT_MULTI_WAYS; i++)
+            memcpy(&vInput[i * 80], &input[(nCount - 1) * 80], 80);
+        scrypt_1024_1_1_256_sp_avx2(vInput, vOutput, scratchpad);
+        memcpy(output, vOutput, nCount * 32);
+        return;
+    }
+#endif // USE_AVX2
+    for (int i = 0; i < nCount; i++)
+        scrypt_1024_1_1_256_sp(&input[i * 80], &output[i * 32], scratchpad);
+}
+
+void scrypt_1024_1_1_256_midstate(const char *input, scrypt_midstate *midstate)
+{
+	memcpy(midstate->header, input, 80);
+	SHA256_Init(&midstate->keyctx);
+	SHA256_Update(&midstate->keyctx, input, 64);
+}
+
+/*
+ * First PBKDF2 pass for one nonce of the midstate's header. Leaves the keyed
+ * HMAC state in keyctx for the final pass, which uses the same password.
+ */
+static void
+scrypt_midstate_begin(const scrypt_midstate *midstate, uint32_t nonce,
+    HMAC_SHA256_CTX *keyctx, uint8_t B[128])
+{
+	uint8_t header[80];
+	uint8_t khash[32];
+	SHA256_CTX ctx;
+
+	memcpy(header, midstate->header, 80);
+	le32enc(&header[76], nonce);
+
+	/* The 80 byte key is longer than a block, so the HMAC key is SHA256(header). */
+	memcpy(&ctx, &midstate->keyctx, sizeof(SHA256_CTX));
+	SHA256_Update(&ctx, &header[64], 16);
+	SHA256_Final(khash, &ctx);
+	HMAC_SHA256_Init(keyctx, khash, 32);
+
+	PBKDF2_SHA256_1(keyctx, header, 80, B, 128);
+}
+
+void scrypt_1024_1_1_256_sp_nonces(const scrypt_midstate *midstate, uint32_t nNonce, char *output, char *scratchpad, int nCount)
+{
+	HMAC_SHA256_CTX keyctx[SCRYPT_MULTI_WAYS];
+	uint8_t B[128];
+	int lane;
+	uint32_t k;
+
+#if defined(USE_AVX2)
+	if (fUseAVX2 && nCount > 1) {
+		uint32_t X[32 * SCRYPT_MULTI_WAYS];
+
+		for (lane = 0; lane < nCount; lane++) {
+			scrypt_midstate_begin(midstate, nNonce + lane, &keyctx[lane], B);
+			for (k = 0; k < 32; k++)
+				X[k * SCRYPT_MULTI_WAYS + lane] = le32dec(&B[4 * k]);
+		}
+		/* Unused lanes repeat the last nonce, their results are dropped. */
+		for (; lane < SCRYPT_MULTI_WAYS; lane++)
+			for (k = 0; k < 32; k++)
+				X[k * SCRYPT_MULTI_WAYS + lane] = X[k * SCRYPT_MULTI_WAYS + nCount - 1];
+
+		scrypt_core_avx2_8way(X, scratchpad);
+
+		for (lane = 0; lane < nCount; lane++) {
+			for (k = 0; k < 32; k++)
+				le32enc(&B[4 * k], X[k * SCRYPT_MULTI_WAYS + lane]);
+			PBKDF2_SHA256_1(&keyctx[lane], B, 128, (uint8_t *)output + lane * 32, 32);
+		}
+		return;
+	}
+#endif // USE_AVX2
+	uint32_t X[32];
+	uint32_t *V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (lane = 0; lane < nCount; lane++) {
+		scrypt_midstate_begin(midstate, nNonce + lane, &keyctx[lane], B);
+		for (k = 0; k < 32; k++)
+			X[k] = le32dec(&B[4 * k]);
+
+		scrypt_core(X, V);
+
+		for (k = 0; k < 32; k++)
+			le32enc(&B[4 * k], X[k]);
+		PBKDF2_SHA256_1(&keyctx[lane], B, 128, (uint8_t *)output + lane * 32, 32);
+	}
+}
+
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
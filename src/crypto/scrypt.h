@@ -2,12 +2,46 @@
 #define SCRYPT_H
 #include <stdlib.h>
 #include <stdint.h>
+#include <openssl/sha.h>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Maximum number of 80 byte inputs hashed by one scrypt_1024_1_1_256_sp_multi call */
+static const int SCRYPT_MULTI_WAYS = 8;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MULTI_WAYS * 131072 + 63;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Hash nCount (at most SCRYPT_MULTI_WAYS) consecutive 80 byte inputs into nCount
+ * consecutive 32 byte outputs. The scratchpad must hold SCRYPT_MULTI_SCRATCHPAD_SIZE
+ * bytes. Uses the interleaved AVX2 kernel when scrypt_detect_avx2() selected it and
+ * falls back to one scrypt_1024_1_1_256_sp per input otherwise.
+ */
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, int nCount);
+/**
+ * Precomputed state for hashing one 80 byte header with varying nonces. Holds
+ * the SHA-256 state over the first 64 header bytes, which is the part of the
+ * PBKDF2 key hash that does not change with the nonce.
+ */
+struct scrypt_midstate {
+    SHA256_CTX keyctx;
+    unsigned char header[80];
+};
+
+void scrypt_1024_1_1_256_midstate(const char *input, scrypt_midstate *midstate);
+/**
+ * Hash nCount (at most SCRYPT_MULTI_WAYS) copies of the midstate's header with the
+ * consecutive nonces nNonce, nNonce + 1, ... into nCount consecutive 32 byte outputs.
+ * The scratchpad must hold SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+ */
+void scrypt_1024_1_1_256_sp_nonces(const scrypt_midstate *midstate, uint32_t nNonce, char *output, char *scratchpad, int nCount);
+/** Select the multi-lane kernel if the CPU supports it, returns the number of lanes hashed at once */
+int scrypt_detect_avx2();
+/** Number of inputs scrypt_1024_1_1_256_sp_multi hashes in parallel (1 without AVX2) */
+int scrypt_multi_ways();
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -23,6 +57,13 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+#if defined(USE_AVX2)
+/** Eight-way interleaved kernel, always hashes SCRYPT_MULTI_WAYS inputs. Only call it on CPUs with AVX2. */
+void scrypt_1024_1_1_256_sp_avx2(const char *input, char *output, char *scratchpad);
+/** ROMix over SCRYPT_MULTI_WAYS interleaved lanes, word k of lane l is X[k * SCRYPT_MULTI_WAYS + l] */
+void scrypt_core_avx2_8way(uint32_t *X, char *scratchpad);
+#endif
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,13 @@ public:
     CSHA256& Reset();
 };
 
+/** Select the fastest SHA-256 implementations this CPU supports, after a
+ *  self-test of each. Returns a description of the ones in use. Call it once
+ *  at startup, before any other thread hashes. */
+std::string SHA256AutoDetect();
+
+/** Compute the double SHA-256 of each of blocks consecutive 64-byte inputs,
+ *  writing blocks consecutive 32-byte hashes to out. */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
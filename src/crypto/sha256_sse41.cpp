@@ -0,0 +1,128 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(USE_SSE41)
+#include <immintrin.h>
+
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+
+/*
+ * Each __m128i holds the same 32-bit word of four independent SHA-256
+ * computations, so the rounds below are the scalar ones in crypto/sha256.cpp
+ * with every operand widened to four lanes.
+ */
+#define ADD4(a, b) _mm_add_epi32((a), (b))
+#define XOR4(a, b) _mm_xor_si128((a), (b))
+#define ROTR4(a, n) _mm_or_si128(_mm_srli_epi32((a), (n)), _mm_slli_epi32((a), 32 - (n)))
+#define CH4(x, y, z) XOR4((z), _mm_and_si128((x), XOR4((y), (z))))
+#define MAJ4(x, y, z) _mm_or_si128(_mm_and_si128((x), (y)), _mm_and_si128((z), _mm_or_si128((x), (y))))
+#define BSIG04(x) XOR4(XOR4(ROTR4((x), 2), ROTR4((x), 13)), ROTR4((x), 22))
+#define BSIG14(x) XOR4(XOR4(ROTR4((x), 6), ROTR4((x), 11)), ROTR4((x), 25))
+#define SSIG04(x) XOR4(XOR4(ROTR4((x), 7), ROTR4((x), 18)), _mm_srli_epi32((x), 3))
+#define SSIG14(x) XOR4(XOR4(ROTR4((x), 17), ROTR4((x), 19)), _mm_srli_epi32((x), 10))
+
+namespace
+{
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t INIT[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+__attribute__((target("sse4.1"))) inline void Round(__m128i a, __m128i b, __m128i c, __m128i& d, __m128i e, __m128i f, __m128i g, __m128i& h, __m128i kw)
+{
+    __m128i t1 = ADD4(ADD4(h, BSIG14(e)), ADD4(CH4(e, f, g), kw));
+    __m128i t2 = ADD4(BSIG04(a), MAJ4(a, b, c));
+    d = ADD4(d, t1);
+    h = ADD4(t1, t2);
+}
+
+/** One SHA-256 transformation of four states, with the first 16 message words in w. */
+__attribute__((target("sse4.1"))) void Transform(__m128i* s, __m128i* w)
+{
+    for (int i = 16; i < 64; i++)
+        w[i] = ADD4(ADD4(SSIG14(w[i - 2]), w[i - 7]), ADD4(SSIG04(w[i - 15]), w[i - 16]));
+
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, ADD4(_mm_set1_epi32(K[i + 0]), w[i + 0]));
+        Round(h, a, b, c, d, e, f, g, ADD4(_mm_set1_epi32(K[i + 1]), w[i + 1]));
+        Round(g, h, a, b, c, d, e, f, ADD4(_mm_set1_epi32(K[i + 2]), w[i + 2]));
+        Round(f, g, h, a, b, c, d, e, ADD4(_mm_set1_epi32(K[i + 3]), w[i + 3]));
+        Round(e, f, g, h, a, b, c, d, ADD4(_mm_set1_epi32(K[i + 4]), w[i + 4]));
+        Round(d, e, f, g, h, a, b, c, ADD4(_mm_set1_epi32(K[i + 5]), w[i + 5]));
+        Round(c, d, e, f, g, h, a, b, ADD4(_mm_set1_epi32(K[i + 6]), w[i + 6]));
+        Round(b, c, d, e, f, g, h, a, ADD4(_mm_set1_epi32(K[i + 7]), w[i + 7]));
+    }
+    s[0] = ADD4(s[0], a);
+    s[1] = ADD4(s[1], b);
+    s[2] = ADD4(s[2], c);
+    s[3] = ADD4(s[3], d);
+    s[4] = ADD4(s[4], e);
+    s[5] = ADD4(s[5], f);
+    s[6] = ADD4(s[6], g);
+    s[7] = ADD4(s[7], h);
+}
+
+__attribute__((target("sse4.1"))) void Initialize(__m128i* s)
+{
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm_set1_epi32(INIT[i]);
+}
+} // namespace
+
+__attribute__((target("sse4.1"))) void sha256d64_sse41::Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], w[64];
+
+    // The 64 byte inputs, one per lane
+    Initialize(s);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+    Transform(s, w);
+
+    // Their padding block, the same for every lane
+    w[0] = _mm_set1_epi32(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(512);
+    Transform(s, w);
+
+    // The second hash, over the 32 byte first hashes
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = _mm_set1_epi32(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(256);
+    Initialize(s);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        uint32_t v[4];
+        _mm_storeu_si128((__m128i*)v, s[i]);
+        for (int j = 0; j < 4; j++)
+            WriteBE32(out + 32 * j + 4 * i, v[j]);
+    }
+}
+
+#endif // USE_SSE41
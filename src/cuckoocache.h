@@ -0,0 +1,164 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+
+/**
+ * Fixed size set of elements, each of which can live in one of eight table
+ * slots picked by hashes of the element (cuckoo hashing). There is no per
+ * element allocation, so a given amount of memory holds many more entries
+ * than a node based set, and lookups touch at most eight slots.
+ *
+ * Inserting into a full neighbourhood moves an existing element to one of its
+ * other slots, up to log2(size) times, after which the element left over is
+ * dropped. Slots are only reused once they are marked erasable, either by
+ * contains(e, true) or by the generation scheme below: when the newer half of
+ * the entries has grown past 45% of the table, the older half is marked
+ * erasable and the newer half becomes the older one.
+ *
+ * Hash must provide uint32_t operator()(const Element&, unsigned int n) const
+ * returning eight independent, uniformly distributed hashes for n = 0..7.
+ *
+ * Thread safety: contains() may run concurrently with other contains() calls,
+ * as the erasable flags it sets are atomic, but insert() and setup_bytes() need
+ * exclusive access. The flags are accessed with relaxed ordering: what goes
+ * with them is only changed under that exclusive access.
+ */
+template <typename Element, typename Hash>
+class cuckoocache
+{
+private:
+    std::vector<Element> table;
+    uint32_t size;
+    //! Per slot: 1 if the slot may be overwritten
+    mutable boost::scoped_array<boost::atomic<unsigned char> > vErasable;
+    //! Per slot: true if the element belongs to the newer generation
+    std::vector<bool> vEpoch;
+    //! Inserts left before the generations are counted again
+    uint32_t nEpochCountdown;
+    uint32_t nEpochSize;
+    unsigned int nDepthLimit;
+    const Hash hash_function;
+
+    void compute_hashes(const Element& e, uint32_t locs[8]) const
+    {
+        // Map each 32 bit hash onto [0, size) without a division
+        for (unsigned int n = 0; n < 8; n++)
+            locs[n] = (uint32_t)(((uint64_t)hash_function(e, n) * (uint64_t)size) >> 32);
+    }
+
+    void epoch_check()
+    {
+        if (nEpochCountdown != 0) {
+            --nEpochCountdown;
+            return;
+        }
+        uint32_t nEpochUnused = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            nEpochUnused += vEpoch[i] && !vErasable[i].load(boost::memory_order_relaxed);
+        if (nEpochUnused >= nEpochSize) {
+            // Retire the older generation and start a new one
+            for (uint32_t i = 0; i < size; ++i) {
+                if (vEpoch[i])
+                    vEpoch[i] = false;
+                else
+                    vErasable[i].store(1, boost::memory_order_relaxed);
+            }
+            nEpochCountdown = nEpochSize;
+        } else {
+            // Count again once the generation could have filled up, but not
+            // after fewer than 1/16 of its size in inserts
+            nEpochCountdown = std::max(nEpochSize / 16, nEpochSize - nEpochUnused);
+        }
+    }
+
+public:
+    cuckoocache() : size(0), nEpochCountdown(0), nEpochSize(0), nDepthLimit(0), hash_function() {}
+
+    /** Clear the cache and size it to at most nBytes of elements, 0 to disable it. Returns the number of slots. */
+    uint32_t setup_bytes(size_t nBytes)
+    {
+        size_t nElements = nBytes ? std::max((size_t)2, nBytes / sizeof(Element)) : 0;
+        size = (uint32_t)std::min(nElements, (size_t)std::numeric_limits<uint32_t>::max());
+        nDepthLimit = 0;
+        while ((1u << nDepthLimit) < size && nDepthLimit < 31)
+            nDepthLimit++;
+        nEpochSize = std::max((uint32_t)1, (uint32_t)((45 * (uint64_t)size) / 100));
+        nEpochCountdown = nEpochSize;
+        table.assign(size, Element());
+        vErasable.reset(new boost::atomic<unsigned char>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            vErasable[i].store(1, boost::memory_order_relaxed);
+        vEpoch.assign(size, false);
+        return size;
+    }
+
+    void insert(Element e)
+    {
+        if (size == 0)
+            return;
+        epoch_check();
+        uint32_t locs[8];
+        compute_hashes(e, locs);
+        for (unsigned int n = 0; n < 8; n++) {
+            if (table[locs[n]] == e) {
+                // Already present: keep it, as part of the newer generation
+                vErasable[locs[n]].store(0, boost::memory_order_relaxed);
+                vEpoch[locs[n]] = true;
+                return;
+            }
+        }
+
+        uint32_t nLastLoc = (uint32_t)-1;
+        bool fLastEpoch = true;
+        for (unsigned int nDepth = 0; nDepth < nDepthLimit; ++nDepth) {
+            for (unsigned int n = 0; n < 8; n++) {
+                if (!vErasable[locs[n]].load(boost::memory_order_relaxed))
+                    continue;
+                table[locs[n]] = e;
+                vErasable[locs[n]].store(0, boost::memory_order_relaxed);
+                vEpoch[locs[n]] = fLastEpoch;
+                return;
+            }
+            // Evict from the slot after the one we were just moved into, so
+            // the displaced element doesn't bounce straight back
+            unsigned int nNext = std::find(locs, locs + 8, nLastLoc) - locs;
+            nLastLoc = locs[(nNext + 1) & 7];
+            std::swap(table[nLastLoc], e);
+            bool fEpoch = vEpoch[nLastLoc];
+            vEpoch[nLastLoc] = fLastEpoch;
+            fLastEpoch = fEpoch;
+            compute_hashes(e, locs);
+        }
+    }
+
+    /** Check whether e is present. If fErase, its slot may be reused afterwards. */
+    bool contains(const Element& e, bool fErase) const
+    {
+        if (size == 0)
+            return false;
+        uint32_t locs[8];
+        compute_hashes(e, locs);
+        for (unsigned int n = 0; n < 8; n++) {
+            if (table[locs[n]] == e) {
+                if (fErase)
+                    vErasable[locs[n]].store(1, boost::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
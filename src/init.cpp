@@ -13,16 +13,21 @@
 #include "amount.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
+#include "crypto/scrypt.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
+#include "stratum.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utilstrencodings.h"
 #ifdef ENABLE_WALLET
 #include "db.h"
 #include "wallet.h"
@@ -176,6 +181,10 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsPrefetch;
+        pcoinsPrefetch = NULL;
+        delete pcoinsWriter;
+        pcoinsWriter = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -241,7 +250,9 @@ std::string HelpMessage(HelpMessageMode mode)
     string strUsage = _("Options:") + "\n";
     strUsage += "  -?                     " + _("This help message") + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)") + "\n";
-    strUsage += "  -alerts                " + strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS);
+    strUsage += "  -alerts                " + strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS) + "\n";
+    strUsage += "  -assumevalid=<hex>     " + _("If this block is in the chain assume that it and its ancestors are valid and skip their script verification (default: none)") + "\n";
+    strUsage += "  -auditblockindex       " + _("Re-verify the proof of work of the whole block index in the background after startup (default: 0)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -checkblocks=<n>       " + strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288) + "\n";
     strUsage += "  -checklevel=<n>        " + strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3) + "\n";
@@ -257,6 +268,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -prefetchthreads=<n>   " + strprintf(_("Number of threads reading the coins new blocks spend before they are connected (0 to %d, default: %d)"), MAX_SCRIPTCHECK_THREADS, DEFAULT_PREFETCH_THREADS) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "lavrovcoind.pid") + "\n";
 #endif
@@ -335,7 +347,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -debug=<category>      " + strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, stratum"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -350,7 +362,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += "  -limitfreerelay=<n>    " + strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15) + "\n";
         strUsage += "  -relaypriority         " + strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1) + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000) + "\n";
+        strUsage += "  -sigcachemaxmb=<n>     " + strprintf(_("Limit size of signature and script execution caches to <n> MiB, 0 to disable them (default: %u)"), DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
     }
     strUsage += "  -minrelaytxfee=<amt>   " + strprintf(_("Fees (in LVC/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())) + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
@@ -374,6 +386,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -blockmaxsize=<n>      " + strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE) + "\n";
     strUsage += "  -blockprioritysize=<n> " + strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE) + "\n";
 
+    strUsage += "\n" + _("Stratum server options:") + "\n";
+    strUsage += "  -stratum               " + strprintf(_("Accept Stratum mining connections (default: %u)"), 0) + "\n";
+    strUsage += "  -stratumaddress=<addr> " + _("Address that blocks mined through the Stratum server pay to") + "\n";
+    strUsage += "  -stratumbind=<addr>    " + strprintf(_("Bind to given address to listen for Stratum connections (default: %s)"), "127.0.0.1") + "\n";
+    strUsage += "  -stratumdifficulty=<n> " + strprintf(_("Share difficulty sent to Stratum workers (default: %u)"), DEFAULT_STRATUM_DIFFICULTY) + "\n";
+    strUsage += "  -stratumport=<port>    " + strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT) + "\n";
+
     strUsage += "\n" + _("RPC server options:") + "\n";
     strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
     strUsage += "  -rest                  " + strprintf(_("Accept public REST requests (default: %u)"), 0) + "\n";
@@ -664,9 +683,20 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (GetBoolArg("-benchmark", false))
         InitWarning(_("Warning: Unsupported argument -benchmark ignored, use -debug=bench."));
 
+    // -maxsigcachesize counted signatures. Each now takes 32 bytes of the
+    // signature cache's half of -sigcachemaxmb.
+    if (mapArgs.count("-maxsigcachesize")) {
+        int64_t nEntries = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", 0)), MAX_MAX_SIG_CACHE_SIZE << 14);
+        if (SoftSetArg("-sigcachemaxmb", i64tostr((nEntries * 64 + (1 << 20) - 1) >> 20)))
+            InitWarning(strprintf(_("Warning: Unsupported argument -maxsigcachesize, use -sigcachemaxmb. Using -sigcachemaxmb=%s."), GetArg("-sigcachemaxmb", "")));
+    }
+
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
+    hashAssumeValid.SetHex(GetArg("-assumevalid", ""));
+    if (hashAssumeValid != 0)
+        LogPrintf("Assuming ancestors of block %s have valid signatures\n", hashAssumeValid.ToString());
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
@@ -760,6 +790,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Pick the SHA-256 implementation before any other thread starts hashing
+    std::string strSHA256 = SHA256AutoDetect();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Lavrovcoin Core is shutting down."));
@@ -785,6 +818,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Lavrovcoin version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using the '%s' SHA256 implementation\n", strSHA256);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -796,10 +830,18 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    LogPrintf("Using %u threads for script and header verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadHeaderCheck);
+        }
+        // Reading blocks ahead is mostly waiting on the disk, a few threads keep up
+        for (int i=0; i<std::min(nScriptCheckThreads-1, MAX_BLOCK_PIPELINE_THREADS); i++)
+            threadGroup.create_thread(&ThreadBlockPipeline);
     }
 
     /* Start the RPC server already.  It will be started in "warmup" mode
@@ -818,6 +860,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    if (scrypt_detect_avx2() > 1)
+        LogPrintf("scrypt: using %d-way AVX2 kernel for batched hashing\n", scrypt_multi_ways());
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1011,7 +1055,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache;
+    LogPrintf("Using %.1fMiB for in-memory coins\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_SCRIPTCHECK_THREADS));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1025,6 +1072,8 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsPrefetch;
+                delete pcoinsWriter;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1032,7 +1081,19 @@ bool AppInit2(boost::thread_group& threadGroup)
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsWriter = new CCoinsViewWriteBehind(pcoinscatcher);
+                if (nPrefetchThreads > 0) {
+                    pcoinsPrefetch = new CCoinsViewPrefetch(pcoinsWriter);
+                    pcoinsTip = new CCoinsViewCache(pcoinsPrefetch);
+                } else {
+                    pcoinsPrefetch = NULL;
+                    pcoinsTip = new CCoinsViewCache(pcoinsWriter);
+                }
+
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading coin database");
+                    break;
+                }
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -1249,6 +1310,13 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif // !ENABLE_WALLET
     // ********************************************************* Step 9: import blocks
 
+    if (pcoinsPrefetch != NULL) {
+        LogPrintf("Using %u threads to read coins ahead of connecting blocks\n", nPrefetchThreads);
+        for (int i = 0; i < nPrefetchThreads; i++)
+            threadGroup.create_thread(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, pcoinsPrefetch));
+    }
+    threadGroup.create_thread(boost::bind(&CCoinsViewWriteBehind::ThreadWrite, pcoinsWriter));
+
     if (mapArgs.count("-blocknotify"))
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
@@ -1291,6 +1359,15 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    if (GetBoolArg("-stratum", false)) {
+        std::string strError;
+        if (!StartStratumServer(threadGroup, strError))
+            return InitError(strError);
+    }
+
+    if (GetBoolArg("-auditblockindex", false))
+        threadGroup.create_thread(boost::bind(&ThreadAuditBlockIndex, std::max(nScriptCheckThreads, 1)));
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (pwalletMain)
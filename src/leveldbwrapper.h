@@ -59,6 +59,11 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CLevelDBWrapper
@@ -168,6 +173,12 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for short scans, which use the block cache like Read() does
+    leveldb::Iterator* NewReadIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
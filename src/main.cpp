@@ -10,10 +10,14 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/scrypt.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "init.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -25,6 +29,7 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -52,7 +57,8 @@ bool fReindex = false;
 bool fTxIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+uint256 hashAssumeValid;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -542,6 +548,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
+CCoinsViewWriteBehind *pcoinsWriter = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1087,23 +1095,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        PrecomputedTransactionData txdata;
+        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata))
         {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
+        // Check again against just the consensus-critical script verification
+        // flags the next block will be checked with, in case of bugs in the
+        // standard flags that cause transactions to pass as valid when they're
+        // actually invalid. For instance the STRICTENC flag was incorrectly
+        // allowing certain CHECKSIG NOT scripts to pass, even though they were
+        // invalid. The pass is cached, so ConnectBlock can skip these scripts.
         //
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        unsigned int nNextBlockFlags = GetBlockScriptFlags(CBlockHeader::CURRENT_VERSION, GetAdjustedTime(), chainActive.Tip());
+        if (!CheckInputs(tx, state, view, true, nNextBlockFlags, true, true, txdata))
         {
-            return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
+            return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against consensus but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
@@ -1207,7 +1218,7 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
 {
     block.SetNull();
 
@@ -1225,7 +1236,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits))
         return error("ReadBlockFromDisk : Errors in block header");
 
     return true;
@@ -1233,7 +1244,10 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // A header-valid index entry already had its scrypt proof of work checked
+    // when it was accepted, and the GetHash() comparison below ties the block
+    // on disk to that entry, so only entries without that status pay for it.
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), !pindex->IsValid(BLOCK_VALID_HEADER)))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
@@ -1525,19 +1539,140 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, txdata), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+namespace {
+
+/**
+ * Transactions whose scripts all passed under a set of flags, mostly on
+ * mempool acceptance, so that ConnectBlock can skip them. Entries are
+ * SHA256(nonce || txid || flags). Protected by cs_main.
+ */
+uint256 scriptExecutionCacheNonce;
+cuckoocache<uint256, CSignatureCacheHasher> scriptExecutionCache;
+
+} // anon namespace
+
+void InitScriptExecutionCache()
+{
+    LOCK(cs_main);
+    GetRandBytes(scriptExecutionCacheNonce.begin(), 32);
+    size_t nBytes = GetMaxSigCacheBytes() / 2;
+    uint32_t nElements = scriptExecutionCache.setup_bytes(nBytes);
+    LogPrintf("Using %u bytes for the script execution cache, able to store %u transactions\n", nBytes, nElements);
+}
+
+/**
+ * The checks of CheckInputs that don't involve scripts: maturity of spent
+ * coinbases, and the input and fee amounts. vCoins holds the coins each
+ * input spends, which must all be available.
+ */
+static bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const std::vector<const CCoins*>& vCoins, int nSpendHeight, CAmount& nTxFee)
 {
-    if (!tx.IsCoinBase())
+    CAmount nValueIn = 0;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const CCoins *coins = vCoins[i];
+        assert(coins);
+
+        // If prev is coinbase, check that it's matured
+        if (coins->IsCoinBase()) {
+            if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+                return state.Invalid(
+                    error("CheckInputs() : tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                    REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
+        }
+
+        // Check for negative or overflow input values
+        nValueIn += coins->vout[prevout.n].nValue;
+        if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            return state.DoS(100, error("CheckInputs() : txin values out of range"),
+                             REJECT_INVALID, "bad-txns-inputvalues-outofrange");
+
+    }
+
+    if (nValueIn < tx.GetValueOut())
+        return state.DoS(100, error("CheckInputs() : %s value in (%s) < value out (%s)",
+                                    tx.GetHash().ToString(), FormatMoney(nValueIn), FormatMoney(tx.GetValueOut())),
+                         REJECT_INVALID, "bad-txns-in-belowout");
+
+    // Tally transaction fees
+    nTxFee = nValueIn - tx.GetValueOut();
+    if (nTxFee < 0)
+        return state.DoS(100, error("CheckInputs() : %s nTxFee < 0", tx.GetHash().ToString()),
+                         REJECT_INVALID, "bad-txns-fee-negative");
+    if (!MoneyRange(nTxFee))
+        return state.DoS(100, error("CheckInputs() : nFees out of range"),
+                         REJECT_INVALID, "bad-txns-fee-outofrange");
+    return true;
+}
+
+/**
+ * The script checks of CheckInputs, for a transaction whose inputs are all available.
+ * cacheErase drops a script execution cache hit, for callers that won't look the
+ * transaction up again (connecting it in a block).
+ */
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheStore, bool cacheFullScriptStore, bool cacheErase, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    AssertLockHeld(cs_main);
+    if (pvChecks)
+        pvChecks->reserve(tx.vin.size());
+
+    uint256 hashCacheEntry;
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 32).Write(tx.GetHash().begin(), 32).Write((const unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    if (scriptExecutionCache.contains(hashCacheEntry, cacheErase))
+        return true;
+
+    txdata.Init(tx);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const CCoins* coins = inputs.AccessCoins(prevout.hash);
+        assert(coins);
+
+        // Verify signature
+        CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+        if (pvChecks) {
+            pvChecks->push_back(CScriptCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+                // Check whether the failure was caused by a
+                // non-mandatory script verification check, such as
+                // non-standard DER encodings or non-null dummy
+                // arguments; if so, don't trigger DoS protection to
+                // avoid splitting the network between upgraded and
+                // non-upgraded nodes.
+                CScriptCheck check(*coins, tx, i,
+                        flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
+                if (check())
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+            }
+            // Failures of other flags indicate a transaction that is
+            // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+            // such nodes as they are not following the protocol. That
+            // said during an upgrade careful thought should be taken
+            // as to the correct behavior - we may want to continue
+            // peering with non-upgraded nodes even after a soft-fork
+            // super-majority vote has passed.
+            return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+        }
+    }
+
+    // Only remember the pass if every script was actually run above
+    if (cacheFullScriptStore && !pvChecks)
+        scriptExecutionCache.insert(hashCacheEntry);
+    return true;
+}
 
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    if (!tx.IsCoinBase())
+    {
         // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
         // for an attacker to attempt to split the network.
         if (!inputs.HaveInputs(tx))
@@ -1547,87 +1682,23 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // This is also true for mempool checks.
         CBlockIndex *pindexPrev = mapBlockIndex.find(inputs.GetBestBlock())->second;
         int nSpendHeight = pindexPrev->nHeight + 1;
-        CAmount nValueIn = 0;
-        CAmount nFees = 0;
+        std::vector<const CCoins*> vCoins;
+        vCoins.reserve(tx.vin.size());
         for (unsigned int i = 0; i < tx.vin.size(); i++)
-        {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
-
-            // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
-                    return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
-                        REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
-            }
-
-            // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
-                return state.DoS(100, error("CheckInputs() : txin values out of range"),
-                                 REJECT_INVALID, "bad-txns-inputvalues-outofrange");
-
-        }
-
-        if (nValueIn < tx.GetValueOut())
-            return state.DoS(100, error("CheckInputs() : %s value in (%s) < value out (%s)",
-                                        tx.GetHash().ToString(), FormatMoney(nValueIn), FormatMoney(tx.GetValueOut())),
-                             REJECT_INVALID, "bad-txns-in-belowout");
-
-        // Tally transaction fees
-        CAmount nTxFee = nValueIn - tx.GetValueOut();
-        if (nTxFee < 0)
-            return state.DoS(100, error("CheckInputs() : %s nTxFee < 0", tx.GetHash().ToString()),
-                             REJECT_INVALID, "bad-txns-fee-negative");
-        nFees += nTxFee;
-        if (!MoneyRange(nFees))
-            return state.DoS(100, error("CheckInputs() : nFees out of range"),
-                             REJECT_INVALID, "bad-txns-fee-outofrange");
+            vCoins.push_back(inputs.AccessCoins(tx.vin[i].prevout.hash));
+        CAmount nTxFee;
+        if (!CheckTxInputs(tx, state, vCoins, nSpendHeight, nTxFee))
+            return false;
 
-        // The first loop above does all the inexpensive checks.
+        // The checks above are the inexpensive ones.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
 
         // Skip ECDSA signature verification when connecting blocks
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
-        if (fScriptChecks) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
-
-                // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
-                }
-            }
-        }
+        if (fScriptChecks && !CheckInputScripts(tx, state, inputs, flags, cacheStore, cacheFullScriptStore, false, txdata, pvChecks))
+            return false;
     }
 
     return true;
@@ -1747,24 +1818,166 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS - 1);
 
 void ThreadScriptCheck() {
     RenameThread("lavrovcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure checking the proof of work of up to SCRYPT_MULTI_WAYS consecutive
+ * headers with one multi-lane scrypt call.
+ * Note that this stores a pointer into the caller's header vector
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    unsigned int nCount;
+
+public:
+    CHeaderPoWCheck(): pheaders(NULL), nCount(0) {}
+    CHeaderPoWCheck(const CBlockHeader *pheadersIn, unsigned int nCountIn) :
+        pheaders(pheadersIn), nCount(nCountIn) { }
+
+    bool operator()() {
+        boost::scoped_array<char> scratchpad(new char[SCRYPT_MULTI_SCRATCHPAD_SIZE]);
+        uint256 hashes[SCRYPT_MULTI_WAYS];
+        scrypt_1024_1_1_256_sp_multi(BEGIN(pheaders[0].nVersion), BEGIN(hashes[0]), scratchpad.get(), nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+            if (!CheckProofOfWork(hashes[i], pheaders[i].nBits))
+                return false;
+        return true;
+    }
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(1, MAX_SCRIPTCHECK_THREADS - 1);
+
+void ThreadHeaderCheck() {
+    RenameThread("lavrovcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Check the proof of work of the headers of a headers message that we don't
+ * know yet, spread over the header check threads, without holding cs_main.
+ * They are only scrypted once the first header is known to connect to a
+ * block we have, and then a round at a time, in order, up to the first round
+ * with a failure. The caller is expected to have checked that the headers
+ * follow each other.
+ * Returns how many headers, from the first, have had their proof of work
+ * checked; the caller has to check the others serially, which also finds the
+ * culprit of a failure.
+ */
+static unsigned int CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers)
+{
+    // Headers already in the index had their proof of work checked when accepted
+    std::vector<CBlockHeader> vNew;
+    std::vector<unsigned int> vPos;
+    vNew.reserve(headers.size());
+    vPos.reserve(headers.size());
+    {
+        LOCK(cs_main);
+        // AcceptBlockHeader turns these down anyway, after scrypting just one
+        if (headers.empty() || !mapBlockIndex.count(headers[0].hashPrevBlock))
+            return 0;
+        for (unsigned int i = 0; i < headers.size(); i++) {
+            if (!mapBlockIndex.count(headers[i].GetHash())) {
+                vNew.push_back(headers[i]);
+                vPos.push_back(i);
+            }
+        }
+    }
+
+    // Enough groups per round to keep every thread busy
+    unsigned int nRound = SCRYPT_MULTI_WAYS * std::max(nScriptCheckThreads, 1);
+    for (unsigned int nStart = 0; nStart < vNew.size(); nStart += nRound) {
+        unsigned int nEnd = std::min(nStart + nRound, (unsigned int)vNew.size());
+        std::vector<CHeaderPoWCheck> vChecks;
+        vChecks.reserve(nRound / SCRYPT_MULTI_WAYS);
+        for (unsigned int i = nStart; i < nEnd; i += SCRYPT_MULTI_WAYS)
+            vChecks.push_back(CHeaderPoWCheck(&vNew[i], std::min((unsigned int)SCRYPT_MULTI_WAYS, nEnd - i)));
+
+        bool fOk = true;
+        if (!nScriptCheckThreads) {
+            for (unsigned int i = 0; i < vChecks.size() && fOk; i++)
+                fOk = vChecks[i]();
+        } else {
+            CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+            control.Add(vChecks);
+            fOk = control.Wait();
+        }
+        if (!fOk)
+            return vPos[nStart];
+    }
+    return headers.size();
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+unsigned int GetBlockScriptFlags(int nVersion, int64_t nTime, const CBlockIndex* pindexPrev)
+{
+    // BIP16 didn't become active until Oct 1 2012
+    int64_t nBIP16SwitchTime = 1349049600;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindexPrev, Params().EnforceBlockUpgradeMajority())) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (nVersion >= 4 && CBlockIndex::IsSuperMajority(4, pindexPrev, Params().EnforceBlockUpgradeMajority())) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    return flags;
+}
+
+/**
+ * Whether -assumevalid lets us skip the scripts of pindex: it has to be an
+ * ancestor of the assumed valid block, which has to be in the best header
+ * chain, with at least ASSUMEVALID_MIN_BURY_TIME worth of work on top of
+ * pindex. The latter keeps a recent block from being assumed valid when we
+ * haven't seen much of the chain yet, e.g. when someone feeds us headers of
+ * a fork that includes it.
+ */
+static bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    if (hashAssumeValid == 0 || pindexBestHeader == NULL)
+        return false;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end())
+        return false;
+    const CBlockIndex* pindexAssumeValid = it->second;
+    if (pindexAssumeValid->GetAncestor(pindex->nHeight) != pindex ||
+        pindexBestHeader->GetAncestor(pindexAssumeValid->nHeight) != pindexAssumeValid)
+        return false;
+    return pindexBestHeader->nChainWork - pindex->nChainWork >=
+           GetBlockProof(*pindexBestHeader) * (uint32_t)(ASSUMEVALID_MIN_BURY_TIME / Params().TargetSpacing());
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     AssertLockHeld(cs_main);
-    // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    // Check it again in case a previous version let a bad block in. The proof
+    // of work of a header-valid index entry was already checked when its header
+    // was accepted, so don't pay for another scrypt here.
+    if (!CheckBlock(block, state, !fJustCheck && !pindex->IsValid(BLOCK_VALID_HEADER), !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -1778,7 +1991,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return true;
     }
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate() && !IsAssumedValid(pindex);
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -1801,26 +2014,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Oct 1 2012
-    int64_t nBIP16SwitchTime = 1349049600;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindex->pprev, Params().EnforceBlockUpgradeMajority())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && CBlockIndex::IsSuperMajority(4, pindex->pprev, Params().EnforceBlockUpgradeMajority())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
+    unsigned int flags = GetBlockScriptFlags(block.nVersion, pindex->GetBlockTime(), pindex->pprev);
 
     CBlockUndo blockundo;
 
+    // Queued script checks point into txdata, so it must outlive control
+    std::vector<PrecomputedTransactionData> txdata(block.vtx.size());
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -1847,7 +2046,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, error("ConnectBlock() : inputs missing/spent"),
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
 
-            if (fStrictPayToScriptHash)
+            if (flags & SCRIPT_VERIFY_P2SH)
             {
                 // Add in sigops done by pay-to-script-hash inputs;
                 // this is to prevent a "rogue miner" from creating
@@ -1858,10 +2057,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                      REJECT_INVALID, "bad-blk-sigops");
             }
 
-            nFees += view.GetValueIn(tx)-tx.GetValueOut();
+            std::vector<const CCoins*> vCoins;
+            vCoins.reserve(tx.vin.size());
+            for (unsigned int j = 0; j < tx.vin.size(); j++)
+                vCoins.push_back(view.AccessCoins(tx.vin[j].prevout.hash));
+            CAmount nTxFee;
+            if (!CheckTxInputs(tx, state, vCoins, pindex->nHeight, nTxFee))
+                return false;
+            nFees += nTxFee;
 
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            // Keep cache entries when only checking (e.g. a block template);
+            // when really connecting, they are consulted and then dropped
+            bool fCacheResults = fJustCheck;
+            if (fScriptChecks && !CheckInputScripts(tx, state, view, flags, fCacheResults, fCacheResults, !fJustCheck, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
@@ -1888,6 +2097,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
+    if (fScriptChecks && nScriptCheckThreads && LogAcceptCategory("bench")) {
+        std::vector<CCheckQueueWorkerStats> vStats;
+        int64_t nWall = scriptcheckqueue.GetStats(vStats);
+        for (unsigned int i = 0; i < vStats.size(); i++)
+            LogPrint("bench", "        - Script check thread %u: %u checks, %u steals, busy %.2fms, idle %.2fms\n", i, vStats[i].nChecks, vStats[i].nSteals, 0.001 * vStats[i].nBusyMicros, 0.001 * (nWall - vStats[i].nBusyMicros));
+    }
 
     if (fJustCheck)
         return true;
@@ -1947,8 +2162,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+    // What is still being written in the background counts as well
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsageInUse() + (pcoinsWriter ? pcoinsWriter->DynamicMemoryUsage() : 0);
+    bool fCacheLarge = (mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && cacheSize > nCoinCacheUsage;
+    if ((mode == FLUSH_STATE_ALWAYS) || fCacheLarge ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
@@ -1979,8 +2196,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         }
         pblocktree->Sync();
         // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // The cache keeps what it has, so the next blocks don't start out with
+        // a cold one; only when it is full are the entries that haven't been
+        // used for the longest time evicted.
+        if (!pcoinsTip->Sync())
+            return state.Abort("Failed to write to coin database");
+        // The database is written in the background, unless everything has
+        // to be on disk when we return
+        if (mode == FLUSH_STATE_ALWAYS && pcoinsWriter != NULL && !pcoinsWriter->Wait())
             return state.Abort("Failed to write to coin database");
+        if (fCacheLarge) {
+            pcoinsTip->Trim(nCoinCacheUsage / 100 * COINS_CACHE_TRIM_PERCENT);
+            LogPrint("coindb", "Trimmed coins cache from %u to %u bytes\n", cacheSize, pcoinsTip->DynamicMemoryUsageInUse());
+        }
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
             g_signals.SetBestChain(chainActive.GetLocator());
@@ -2078,6 +2306,149 @@ bool static DisconnectTip(CValidationState &state) {
     return true;
 }
 
+/**
+ * Reads the blocks ActivateBestChainStep is about to connect from disk and
+ * runs the context-free checks (CheckBlock: merkle root, transactions,
+ * sigop count) on them on background threads, so that ConnectTip only has
+ * to do the part that needs the chain state while the next blocks are read
+ * and checked. Blocks that fail a check here are simply not handed out, and
+ * ConnectTip reads and checks them itself to find out why.
+ */
+class CBlockPipeline
+{
+private:
+    struct CBlockJob
+    {
+        CDiskBlockPos pos;
+        bool fCheckPOW;
+        bool fStarted;
+        bool fDone;
+        CBlock block;
+
+        CBlockJob() : fCheckPOW(false), fStarted(false), fDone(false) {}
+    };
+
+    //! Protects everything below
+    boost::mutex mutex;
+    //! Pipeline threads wait on this for work
+    boost::condition_variable condWork;
+    //! ConnectTip waits on this for a block being read
+    boost::condition_variable condDone;
+    std::map<uint256, CBlockJob> mapJobs;
+    std::deque<uint256> queue;
+    int nThreads;
+
+public:
+    CBlockPipeline() : nThreads(0) {}
+
+    /**
+     * Have the given blocks, in the order they will be connected, read and
+     * checked ahead. Anything still pending for other blocks is given up on.
+     */
+    void Queue(const std::vector<CBlockIndex*>& vpindex)
+    {
+        AssertLockHeld(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nThreads == 0)
+            return;
+        std::set<uint256> setWanted;
+        for (unsigned int i = 0; i < vpindex.size() && i < MAX_BLOCKS_IN_PIPELINE; i++)
+            setWanted.insert(vpindex[i]->GetBlockHash());
+        for (std::map<uint256, CBlockJob>::iterator it = mapJobs.begin(); it != mapJobs.end();) {
+            // A thread working on a block finds out when it is done
+            if (!setWanted.count(it->first))
+                mapJobs.erase(it++);
+            else
+                it++;
+        }
+        for (unsigned int i = 0; i < vpindex.size() && i < MAX_BLOCKS_IN_PIPELINE; i++) {
+            const CBlockIndex* pindex = vpindex[i];
+            if (mapJobs.count(pindex->GetBlockHash()))
+                continue;
+            CBlockJob& job = mapJobs[pindex->GetBlockHash()];
+            job.pos = pindex->GetBlockPos();
+            // See ReadBlockFromDisk(CBlock&, const CBlockIndex*)
+            job.fCheckPOW = !pindex->IsValid(BLOCK_VALID_HEADER);
+            queue.push_back(pindex->GetBlockHash());
+        }
+        condWork.notify_all();
+    }
+
+    /**
+     * Take the block of pindex out of the pipeline, waiting for it if a
+     * thread is reading it. Returns false if it wasn't queued, not started
+     * yet, or failed a check.
+     */
+    bool Get(const CBlockIndex* pindex, CBlock& block)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CBlockJob>::iterator it = mapJobs.find(pindex->GetBlockHash());
+        if (it == mapJobs.end())
+            return false;
+        if (!it->second.fStarted) {
+            // Faster to read it ourselves than to wait behind the queue
+            mapJobs.erase(it);
+            return false;
+        }
+        while (!it->second.fDone) {
+            condDone.wait(lock);
+            it = mapJobs.find(pindex->GetBlockHash());
+            if (it == mapJobs.end())
+                return false;
+        }
+        bool fOk = it->second.block.fChecked;
+        if (fOk)
+            std::swap(block, it->second.block);
+        mapJobs.erase(it);
+        return fOk;
+    }
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads++;
+        try {
+            while (true) {
+                while (queue.empty())
+                    condWork.wait(lock);
+                uint256 hash = queue.front();
+                queue.pop_front();
+                std::map<uint256, CBlockJob>::iterator it = mapJobs.find(hash);
+                if (it == mapJobs.end() || it->second.fStarted)
+                    continue;
+                it->second.fStarted = true;
+                CDiskBlockPos pos = it->second.pos;
+                bool fCheckPOW = it->second.fCheckPOW;
+
+                CBlock block;
+                lock.unlock();
+                CValidationState state;
+                if (ReadBlockFromDisk(block, pos, fCheckPOW) && block.GetHash() == hash &&
+                    CheckBlock(block, state, false))
+                    block.fChecked = true;
+                lock.lock();
+
+                it = mapJobs.find(hash);
+                if (it != mapJobs.end()) {
+                    std::swap(it->second.block, block);
+                    it->second.fDone = true;
+                }
+                condDone.notify_all();
+            }
+        } catch (const boost::thread_interrupted&) {
+            nThreads--;
+            throw;
+        }
+    }
+};
+
+static CBlockPipeline blockpipeline;
+
+void ThreadBlockPipeline() {
+    RenameThread("lavrovcoin-blockpipe");
+    blockpipeline.Thread();
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -2095,7 +2466,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        if (!blockpipeline.Get(pindexNew, block) && !ReadBlockFromDisk(block, pindexNew))
             return state.Abort("Failed to read block");
         pblock = &block;
     }
@@ -2236,6 +2607,13 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     }
     nHeight = nTargetHeight;
 
+    // Have the blocks read and checked while the ones before them are connected
+    std::vector<CBlockIndex*> vpindexToRead;
+    BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect)
+        if (pindexConnect != pindexMostWork || !pblock)
+            vpindexToRead.push_back(pindexConnect);
+    blockpipeline.Queue(vpindexToRead);
+
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
         if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
@@ -2569,6 +2947,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked)
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW))
@@ -2764,7 +3145,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -2781,7 +3162,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -2807,13 +3188,13 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     return true;
 }
 
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp)
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, &pindex))
+    if (!AcceptBlockHeader(block, state, &pindex, fCheckPOW))
         return false;
 
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -2822,7 +3203,8 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
-    if ((!CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    // The header, including its proof of work, was validated by AcceptBlockHeader
+    if ((!CheckBlock(block, state, false)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -2849,6 +3231,21 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return state.Abort(std::string("System error: ") + e.what());
     }
 
+    // Start reading the coins it spends, while the blocks before it connect
+    if (pcoinsPrefetch != NULL) {
+        std::set<uint256> setBlockTx;
+        std::vector<uint256> vTxid;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                    if (!setBlockTx.count(txin.prevout.hash) && !pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                        vTxid.push_back(txin.prevout.hash);
+            }
+            setBlockTx.insert(tx.GetHash());
+        }
+        pcoinsPrefetch->Prefetch(vTxid);
+    }
+
     return true;
 }
 
@@ -2916,8 +3313,19 @@ void CBlockIndex::BuildSkip()
 
 bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
 {
+    // Blocks whose header was already accepted (the usual case with headers-first
+    // sync) had their proof of work checked then; everything else pays for the
+    // scrypt exactly once, here, and the rest of the pipeline relies on that.
+    bool fCheckPOW = true;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(pblock->GetHash());
+        if (mi != mapBlockIndex.end() && mi->second->IsValid(BLOCK_VALID_HEADER))
+            fCheckPOW = false;
+    }
+
     // Preliminary checks
-    bool checked = CheckBlock(*pblock, state);
+    bool checked = CheckBlock(*pblock, state, fCheckPOW);
 
     {
         LOCK(cs_main);
@@ -2928,7 +3336,7 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
 
         // Store to disk
         CBlockIndex *pindex = NULL;
-        bool ret = AcceptBlock(*pblock, state, &pindex, dbp);
+        bool ret = AcceptBlock(*pblock, state, &pindex, dbp, false);
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
         }
@@ -3204,7 +3612,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3241,6 +3649,155 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
     return true;
 }
 
+namespace {
+
+/** State shared by the block index audit threads, protected by cs */
+struct CBlockIndexAudit {
+    CCriticalSection cs;
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<CBlockIndex*> vIndex;
+    /** Entries found to be bad, waiting to be marked invalid */
+    std::vector<CBlockIndex*> vInvalid;
+    unsigned int nNext;
+    unsigned int nChecked;
+    unsigned int nInvalid;
+    bool fStarted;
+    bool fRunning;
+
+    CBlockIndexAudit() : nNext(0), nChecked(0), nInvalid(0), fStarted(false), fRunning(false) {}
+} audit;
+
+void AuditBlockIndexWorker()
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    boost::scoped_array<char> scratchpad(new char[SCRYPT_MULTI_SCRATCHPAD_SIZE]);
+    uint256 hashes[SCRYPT_MULTI_WAYS];
+
+    while (true) {
+        boost::this_thread::interruption_point();
+        unsigned int nStart, nCount;
+        {
+            LOCK(audit.cs);
+            if (audit.nNext >= audit.vHeaders.size())
+                return;
+            nStart = audit.nNext;
+            nCount = std::min((unsigned int)SCRYPT_MULTI_WAYS, (unsigned int)audit.vHeaders.size() - nStart);
+            audit.nNext += nCount;
+        }
+
+        // vHeaders is not resized while the workers run, so it can be read unlocked
+        scrypt_1024_1_1_256_sp_multi(BEGIN(audit.vHeaders[nStart].nVersion), BEGIN(hashes[0]), scratchpad.get(), nCount);
+
+        LOCK(audit.cs);
+        for (unsigned int i = 0; i < nCount; i++) {
+            if (!CheckProofOfWork(hashes[i], audit.vHeaders[nStart + i].nBits)) {
+                audit.vInvalid.push_back(audit.vIndex[nStart + i]);
+                audit.nInvalid++;
+            }
+        }
+        audit.nChecked += nCount;
+    }
+}
+
+/** Mark the entries the workers flagged as invalid. Returns whether any were found. */
+bool AuditBlockIndexFlush()
+{
+    std::vector<CBlockIndex*> vInvalid;
+    {
+        LOCK(audit.cs);
+        vInvalid.swap(audit.vInvalid);
+    }
+    if (vInvalid.empty())
+        return false;
+
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH(CBlockIndex* pindex, vInvalid) {
+            LogPrintf("AuditBlockIndex() : CheckProofOfWork failed: %s\n", pindex->ToString());
+            if (!InvalidateBlock(state, pindex))
+                LogPrintf("AuditBlockIndex() : InvalidateBlock failed: %s\n", state.GetRejectReason());
+        }
+    }
+    if (state.IsValid())
+        ActivateBestChain(state);
+    return true;
+}
+
+} // anon namespace
+
+bool GetBlockIndexAuditStats(CBlockIndexAuditStats& stats)
+{
+    LOCK(audit.cs);
+    if (!audit.fStarted)
+        return false;
+    stats.fRunning = audit.fRunning;
+    stats.nTotal = audit.vHeaders.size();
+    stats.nChecked = audit.nChecked;
+    stats.nInvalid = audit.nInvalid;
+    return true;
+}
+
+void ThreadAuditBlockIndex(int nThreads)
+{
+    RenameThread("lavrovcoin-auditidx");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    {
+        LOCK2(cs_main, audit.cs);
+        audit.vHeaders.reserve(mapBlockIndex.size());
+        audit.vIndex.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const BlockMap::value_type& item, mapBlockIndex) {
+            CBlockIndex* pindex = item.second;
+            if (pindex->GetBlockHash() == Params().HashGenesisBlock())
+                continue;
+            CBlockHeader header = pindex->GetBlockHeader();
+            // An entry whose header doesn't hash to its own key has been damaged on disk
+            if (header.GetHash() != item.first) {
+                audit.vInvalid.push_back(pindex);
+                audit.nInvalid++;
+                continue;
+            }
+            audit.vHeaders.push_back(header);
+            audit.vIndex.push_back(pindex);
+        }
+        audit.fStarted = true;
+        audit.fRunning = true;
+    }
+    LogPrintf("AuditBlockIndex() : verifying proof of work of %u block index entries using %d threads\n", audit.vHeaders.size(), nThreads);
+    int64_t nStart = GetTimeMillis();
+
+    boost::thread_group workers;
+    try {
+        for (int i = 0; i < nThreads; i++)
+            workers.create_thread(&AuditBlockIndexWorker);
+
+        while (true) {
+            AuditBlockIndexFlush();
+            {
+                LOCK(audit.cs);
+                if (audit.nChecked == audit.vHeaders.size())
+                    break;
+            }
+            MilliSleep(1000);
+        }
+        workers.join_all();
+        AuditBlockIndexFlush();
+    }
+    catch (boost::thread_interrupted)
+    {
+        workers.interrupt_all();
+        workers.join_all();
+        LOCK(audit.cs);
+        audit.fRunning = false;
+        throw;
+    }
+
+    LOCK(audit.cs);
+    audit.fRunning = false;
+    LogPrintf("AuditBlockIndex() : done, %u entries checked, %u invalid, %dms\n", audit.nChecked, audit.nInvalid, GetTimeMillis() - nStart);
+}
+
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
@@ -3373,7 +3930,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                     std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
                         std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
+                        // ProcessNewBlock checks the proof of work
+                        if (ReadBlockFromDisk(block, it->second, false))
                         {
                             LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
                                     head.ToString());
@@ -4289,6 +4847,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // The cheap checks come first, so that a bad message costs us no scrypt
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
+                Misbehaving(pfrom->GetId(), 20);
+                return error("non-continuous headers sequence");
+            }
+        }
+
+        // Scrypt the message in parallel up front. Whatever that didn't vouch for
+        // is checked header by header in AcceptBlockHeader, to find and punish the bad one.
+        unsigned int nChecked = CheckHeadersProofOfWork(headers);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4297,13 +4867,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
-                Misbehaving(pfrom->GetId(), 20);
-                return error("non-continuous headers sequence");
-            }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, n >= nChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include "allocators.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+/**
+ * Estimates of the heap memory used by containers, including the allocator's
+ * overhead, so caches can be limited in bytes rather than in entries. The
+ * sizes don't count the container object itself, which lives wherever its
+ * owner does.
+ */
+namespace memusage
+{
+
+/** Bytes the allocator actually uses for a malloc of alloc bytes. Measured with glibc on Linux. */
+static inline size_t MallocUsage(size_t alloc)
+{
+    if (alloc == 0)
+        return 0;
+    if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    if (sizeof(void*) == 4)
+        return ((alloc + 15) >> 3) << 3;
+    assert(0);
+    return 0;
+}
+
+template<typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+/** What a boost::unordered_map allocates per element: the value and a link to the next one */
+template<typename X>
+struct unordered_node : private X
+{
+private:
+    void* ptr;
+};
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() +
+           MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
+/** A map whose nodes come from a pool uses the pool's chunks, free nodes included */
+template<typename X, typename Y, typename Z, typename E>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, E, pool_allocator<std::pair<const X, Y> > >& m)
+{
+    const CPoolResource* pool = m.get_allocator().pool;
+    size_t nNodes = pool ? pool->MemoryUsage() : MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size();
+    return nNodes + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
+} // namespace memusage
+
+#endif // BITCOIN_MEMUSAGE_H
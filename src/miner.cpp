@@ -20,6 +20,7 @@
 #include "wallet.h"
 #endif
 
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -298,7 +299,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
             CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+            PrecomputedTransactionData txdata;
+            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata))
                 continue;
 
             CTxUndo txundo;
@@ -357,6 +359,9 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
             throw std::runtime_error("CreateNewBlock() : TestBlockValidity failed");
+
+        // Build the merkle tree once, so extra nonce updates only rehash the coinbase's path
+        pblock->BuildMerkleTree();
     }
 
     return pblocktemplate.release();
@@ -372,13 +377,18 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+}
+
+void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     CMutableTransaction txCoinbase(pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 }
 
 #ifdef ENABLE_WALLET
@@ -428,15 +438,80 @@ bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     return true;
 }
 
-void static BitcoinMiner(CWallet *pwallet)
+/**
+ * Block template shared by the miner threads. One thread builds templates and
+ * publishes them here, the others only hash. Each hashing thread claims its own
+ * extra nonce for the current template, so no two of them search the same headers.
+ */
+class CMinerWork
 {
-    LogPrintf("LavrovcoinMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("lavrovcoin-miner");
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The current template, never modified once published
+    boost::shared_ptr<const CBlockTemplate> pblocktemplate;
+    CBlockIndex* pindexPrev;
+    //! Bumped whenever the template is replaced or withdrawn
+    unsigned int nGeneration;
+    //! Last extra nonce handed out for the current template
+    unsigned int nExtraNonce;
+    bool fStopped;
+
+public:
+    CWallet* const pwallet;
+    //! Key the templates pay to, used by all miner threads
+    CReserveKey reservekey;
+    CCriticalSection cs_reservekey;
+
+    CMinerWork(CWallet* pwalletIn) : pindexPrev(NULL), nGeneration(0), nExtraNonce(0), fStopped(false), pwallet(pwalletIn), reservekey(pwalletIn) {}
+
+    //! Replace the current template and wake up the miner threads. NULL withdraws it.
+    void Publish(CBlockTemplate* pblocktemplateIn, CBlockIndex* pindexPrevIn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pblocktemplate.reset(pblocktemplateIn);
+        pindexPrev = pindexPrevIn;
+        nGeneration++;
+        nExtraNonce = 0;
+        cond.notify_all();
+    }
+
+    //! Withdraw the template for good, making the miner threads exit
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStopped = true;
+        pblocktemplate.reset();
+        nGeneration++;
+        cond.notify_all();
+    }
 
-    // Each thread has its own key and counter
-    CReserveKey reservekey(pwallet);
-    unsigned int nExtraNonce = 0;
+    //! Wait for a template and claim an extra nonce for it. Returns false once stopped.
+    bool Claim(boost::shared_ptr<const CBlockTemplate>& pblocktemplateOut, CBlockIndex*& pindexPrevOut, unsigned int& nGenerationOut, unsigned int& nExtraNonceOut)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!pblocktemplate && !fStopped)
+            cond.wait(lock);
+        if (fStopped)
+            return false;
+        pblocktemplateOut = pblocktemplate;
+        pindexPrevOut = pindexPrev;
+        nGenerationOut = nGeneration;
+        nExtraNonceOut = ++nExtraNonce;
+        return true;
+    }
+
+    //! Whether work claimed in the given generation is still current
+    bool IsCurrent(unsigned int nGenerationIn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nGeneration == nGenerationIn;
+    }
+};
+
+void static BitcoinMinerTemplates(CMinerWork& work)
+{
+    CWallet *pwallet = work.pwallet;
 
     try {
         while (true) {
@@ -711,47 +786,125 @@ void static BitcoinMiner(CWallet *pwallet)
 				MilliSleep(300000);
             }
 			
-            auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
-            if (!pblocktemplate.get())
+            CBlockTemplate* pblocktemplate;
+            {
+                LOCK(work.cs_reservekey);
+                pblocktemplate = CreateNewBlockWithKey(work.reservekey);
+            }
+            if (!pblocktemplate)
             {
                 LogPrintf("Error in LavrovcoinMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
-            LogPrintf("Running LavrovcoinMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
-                ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+            LogPrintf("Running LavrovcoinMiner with %u transactions in block (%u bytes)\n", pblocktemplate->block.vtx.size(),
+                ::GetSerializeSize(pblocktemplate->block, SER_NETWORK, PROTOCOL_VERSION));
+            work.Publish(pblocktemplate, pindexPrev);
+
+            // Keep the template until the tip changes, or the mempool did for a minute
+            int64_t nStart = GetTime();
+            {
+                boost::unique_lock<boost::mutex> lock(csBestBlock);
+                while (pindexPrev == chainActive.Tip())
+                {
+                    cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+                    if (vNodes.empty() && Params().MiningRequiresPeers())
+                        break;
+                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                        break;
+                }
+            }
+            // Stale work is withdrawn right away, the next template may take a while
+            if (pindexPrev != chainActive.Tip() || (vNodes.empty() && Params().MiningRequiresPeers()))
+                work.Publish(NULL, NULL);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("LavrovcoinMiner runtime error: %s\n", e.what());
+        return;
+    }
+}
+
+void static BitcoinMinerTemplateThread(boost::shared_ptr<CMinerWork> work)
+{
+    RenameThread("lavrovcoin-minertpl");
+
+    // The miner threads stop together with this one
+    try {
+        BitcoinMinerTemplates(*work);
+    }
+    catch (...)
+    {
+        work->Stop();
+        throw;
+    }
+    work->Stop();
+}
+
+void static BitcoinMiner(boost::shared_ptr<CMinerWork> work)
+{
+    LogPrintf("LavrovcoinMiner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("lavrovcoin-miner");
+
+    // Scrypt state for the nonce search, sized for the widest kernel available.
+    // The scratchpad lives on the heap as it is too large for a thread stack.
+    const int nWays = scrypt_multi_ways();
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    scrypt_midstate midstate;
+    uint256 vHashes[SCRYPT_MULTI_WAYS];
+
+    try {
+        boost::shared_ptr<const CBlockTemplate> pblocktemplate;
+        CBlockIndex* pindexPrev;
+        unsigned int nGeneration;
+        unsigned int nExtraNonce;
+        while (work->Claim(pblocktemplate, pindexPrev, nGeneration, nExtraNonce)) {
+            CBlock block(pblocktemplate->block);
+            CBlock *pblock = &block;
+            SetExtraNonce(pblock, pindexPrev, nExtraNonce);
 
             //
             // Search
             //
-            int64_t nStart = GetTime();
             uint256 hashTarget = uint256().SetCompact(pblock->nBits);
-            uint256 thash;
             while (true) {
                 unsigned int nHashesDone = 0;
-                char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+                bool fFound = false;
+                // Only the nonce changes below, so hash the fixed part of the header once
+                scrypt_1024_1_1_256_midstate(BEGIN(pblock->nVersion), &midstate);
                 while(true)
                 {
-                    scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-                    if (thash <= hashTarget)
+                    // Hash nWays consecutive nonces at once
+                    scrypt_1024_1_1_256_sp_nonces(&midstate, pblock->nNonce, BEGIN(vHashes[0]), &vScratchpad[0], nWays);
+                    for (int i = 0; i < nWays; i++)
                     {
-                        // Found a solution
-                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                        LogPrintf("LavrovcoinMiner:\n");
-                        LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", thash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, *pwallet, reservekey);
-                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                        if (vHashes[i] <= hashTarget)
+                        {
+                            // Found a solution
+                            pblock->nNonce += i;
+                            SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                            LogPrintf("LavrovcoinMiner:\n");
+                            LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", vHashes[i].GetHex(), hashTarget.GetHex());
+                            {
+                                LOCK(work->cs_reservekey);
+                                ProcessBlockFound(pblock, *work->pwallet, work->reservekey);
+                            }
+                            SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
-                        // In regression test mode, stop mining after a block is found.
-                        if (Params().MineBlocksOnDemand())
-                            throw boost::thread_interrupted();
+                            // In regression test mode, stop mining after a block is found.
+                            if (Params().MineBlocksOnDemand())
+                                throw boost::thread_interrupted();
 
-                        break;
+                            fFound = true;
+                            break;
+                        }
                     }
-                    pblock->nNonce += 1;
-                    nHashesDone += 1;
+                    if (fFound)
+                        break;
+                    pblock->nNonce += nWays;
+                    nHashesDone += nWays;
                     if ((pblock->nNonce & 0xFF) == 0)
                         break;
                 }
@@ -787,14 +940,11 @@ void static BitcoinMiner(CWallet *pwallet)
 
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                if (vNodes.empty() && Params().MiningRequiresPeers())
+                if (fFound)
                     break;
                 if (pblock->nNonce >= 0xffff0000)
                     break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (pindexPrev != chainActive.Tip())
+                if (pindexPrev != chainActive.Tip() || !work->IsCurrent(nGeneration))
                     break;
 
                 // Update nTime every few seconds
@@ -842,8 +992,10 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads)
         return;
 
     minerThreads = new boost::thread_group();
+    boost::shared_ptr<CMinerWork> work(new CMinerWork(pwallet));
+    minerThreads->create_thread(boost::bind(&BitcoinMinerTemplateThread, work));
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, work));
 }
 
 #endif // ENABLE_WALLET
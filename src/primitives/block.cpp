@@ -7,6 +7,7 @@
 
 #include "hash.h"
 #include "crypto/scrypt.h"
+#include "crypto/sha256.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
@@ -59,23 +60,26 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
        known ways of changing the transactions without affecting the merkle
        root.
     */
-    vMerkleTree.clear();
-    vMerkleTree.reserve(vtx.size() * 2 + 16); // Safe upper bound for the number of total nodes.
-    for (std::vector<CTransaction>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
-        vMerkleTree.push_back(it->GetHash());
+    size_t nNodes = vtx.size();
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += (nSize + 1) / 2;
+    vMerkleTree.resize(nNodes);
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        vMerkleTree[i] = vtx[i].GetHash();
     int j = 0;
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        // The pairs of a level are adjacent in vMerkleTree, so hash them all
+        // in one batch; only an odd last node is paired with itself.
+        int nPairs = nSize / 2;
+        SHA256D64((unsigned char*)&vMerkleTree[j+nSize], (const unsigned char*)&vMerkleTree[j], nPairs);
+        if (nSize & 1) {
+            vMerkleTree[j+nSize+nPairs] = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                               BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
+        } else if (vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
         }
         j += nSize;
     }
@@ -85,6 +89,27 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
 }
 
+uint256 CBlock::UpdateMerkleTreeCoinbase() const
+{
+    size_t nNodes = vtx.size();
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += (nSize + 1) / 2;
+    if (vtx.empty() || vMerkleTree.size() != nNodes)
+        return BuildMerkleTree();
+
+    // The coinbase's siblings never depend on the coinbase, so only the
+    // leftmost node of each level needs to be recomputed
+    vMerkleTree[0] = vtx[0].GetHash();
+    int j = 0;
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        vMerkleTree[j+nSize] = Hash(BEGIN(vMerkleTree[j]),   END(vMerkleTree[j]),
+                                    BEGIN(vMerkleTree[j+1]), END(vMerkleTree[j+1]));
+        j += nSize;
+    }
+    return vMerkleTree.back();
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
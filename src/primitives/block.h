@@ -84,6 +84,8 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    // memory only: already passed CheckBlock, proof of work included
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -109,6 +111,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -129,6 +132,12 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Update the in-memory merkle tree after a change to the coinbase only, and
+    // return the new merkle root. This rehashes just the left edge of the tree,
+    // so the other transactions must be unchanged since the tree was built; if
+    // no tree of the right shape was built yet it falls back to BuildMerkleTree.
+    uint256 UpdateMerkleTreeCoinbase() const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
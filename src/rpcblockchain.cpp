@@ -7,6 +7,7 @@
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -460,7 +461,20 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"coinscache\": {         (object) the in-memory cache of unspent transaction outputs\n"
+            "     \"transactions\": xxxxxx, (numeric) number of transactions cached\n"
+            "     \"usage\": xxxxxx,       (numeric) memory used, in bytes, as compared to the limit\n"
+            "     \"allocated\": xxxxxx,   (numeric) memory allocated, in bytes, including freed entries kept for reuse\n"
+            "     \"pending\": xxxxxx,     (numeric) memory held by changes still being written to disk, in bytes, included in the above\n"
+            "     \"limit\": xxxxxx        (numeric) usage at which the cache is written to disk (-dbcache), in bytes\n"
+            "  },\n"
+            "  \"indexaudit\": {         (object, only with -auditblockindex) progress of the block index proof of work audit\n"
+            "     \"running\": true|false, (boolean) whether the audit is still in progress\n"
+            "     \"checked\": xxxxxx,     (numeric) number of block index entries checked so far\n"
+            "     \"total\": xxxxxx,       (numeric) number of block index entries to check\n"
+            "     \"invalid\": xxxxxx      (numeric) number of entries found invalid and marked as such\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -475,6 +489,23 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    Object coinscache;
+    coinscache.push_back(Pair("transactions",   (uint64_t)pcoinsTip->GetCacheSize()));
+    size_t nPending = pcoinsWriter ? pcoinsWriter->DynamicMemoryUsage() : 0;
+    coinscache.push_back(Pair("usage",          (uint64_t)(pcoinsTip->DynamicMemoryUsageInUse() + nPending)));
+    coinscache.push_back(Pair("allocated",      (uint64_t)(pcoinsTip->DynamicMemoryUsage() + nPending)));
+    coinscache.push_back(Pair("pending",        (uint64_t)nPending));
+    coinscache.push_back(Pair("limit",          (uint64_t)nCoinCacheUsage));
+    obj.push_back(Pair("coinscache",            coinscache));
+    CBlockIndexAuditStats stats;
+    if (GetBlockIndexAuditStats(stats)) {
+        Object audit;
+        audit.push_back(Pair("running",         stats.fRunning));
+        audit.push_back(Pair("checked",         (int)stats.nChecked));
+        audit.push_back(Pair("total",           (int)stats.nTotal));
+        audit.push_back(Pair("invalid",         (int)stats.nInvalid));
+        obj.push_back(Pair("indexaudit",        audit));
+    }
     return obj;
 }
 
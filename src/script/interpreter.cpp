@@ -12,6 +12,7 @@
 #include "eccryptoverify.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -1075,7 +1076,32 @@ public:
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+void PrecomputedTransactionData::Init(const CTransaction& txTo)
+{
+    if (IsReady())
+        return;
+
+    CDataStream ssInputs(SER_GETHASH, 0);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        ssInputs << txTo.vin[i].prevout << CScript() << txTo.vin[i].nSequence;
+    assert(ssInputs.size() == txTo.vin.size() * SIGHASH_ALL_INPUT_SIZE);
+    vInputs.assign(ssInputs.begin(), ssInputs.end());
+
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    ssOutputs << txTo.vout << txTo.nLockTime;
+    vOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    vPrefix.reserve(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        vPrefix.push_back(ss);
+        ss.write((const char*)&vInputs[i * SIGHASH_ALL_INPUT_SIZE], SIGHASH_ALL_INPUT_SIZE);
+    }
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata)
 {
     if (nIn >= txTo.vin.size()) {
         //  nIn out of range
@@ -1093,6 +1119,21 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (txdata && txdata->IsReady() && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        // Same bytes as below: resume after the inputs before nIn, then only
+        // the signed input needs serializing
+        assert(txdata->vPrefix.size() == txTo.vin.size());
+        CHashWriter ss(txdata->vPrefix[nIn]);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        const unsigned int nInputsEnd = (nIn + 1) * PrecomputedTransactionData::SIGHASH_ALL_INPUT_SIZE;
+        if (nInputsEnd < txdata->vInputs.size())
+            ss.write((const char*)&txdata->vInputs[nInputsEnd], txdata->vInputs.size() - nInputsEnd);
+        ss.write((const char*)&txdata->vOutputs[0], txdata->vOutputs.size());
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1117,7 +1158,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -76,7 +77,28 @@ enum
     SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY = (1U << 9),
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of a transaction's SIGHASH_ALL serialization that don't depend on
+ * the input being signed, so that hashing for each input doesn't reserialize
+ * the whole transaction. Filled in once per transaction by Init().
+ */
+class PrecomputedTransactionData
+{
+public:
+    //! Hash state after nVersion, the input count and the inputs before input i
+    std::vector<CHashWriter> vPrefix;
+    //! All inputs with their scripts blanked, each SIGHASH_ALL_INPUT_SIZE bytes
+    std::vector<unsigned char> vInputs;
+    //! The output count, the outputs and nLockTime
+    std::vector<unsigned char> vOutputs;
+
+    static const unsigned int SIGHASH_ALL_INPUT_SIZE = 41;
+
+    void Init(const CTransaction& txTo);
+    bool IsReady() const { return !vPrefix.empty(); }
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata = NULL);
 
 class BaseSignatureChecker
 {
@@ -99,12 +121,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
 };
@@ -7,20 +7,49 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <string.h>
 #include <vector>
 
+#include <stdint.h>
+
+/** Default and maximum -sigcachemaxmb, in MiB */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
+/**
+ * Hasher for cuckoocache tables of salted SHA-256 entries: the entries are
+ * already uniformly distributed, so their eight 32 bit words serve as the
+ * eight cuckoo hashes.
+ */
+class CSignatureCacheHasher
+{
+public:
+    uint32_t operator()(const uint256& key, unsigned int n) const
+    {
+        uint32_t u;
+        memcpy(&u, key.begin() + 4 * n, 4);
+        return u;
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const PrecomputedTransactionData* txdataIn=NULL) : TransactionSignatureChecker(txToIn, nInIn, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Bytes -sigcachemaxmb allows the signature and script execution caches together, 0 if disabled */
+size_t GetMaxSigCacheBytes();
+/** Size the signature cache according to -sigcachemaxmb */
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,504 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "miner.h"
+#include "net.h"
+#include "netbase.h"
+#include "pow.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <map>
+#include <set>
+
+#include <boost/foreach.hpp>
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_utils.h"
+#include "json/json_spirit_writer_template.h"
+
+using namespace json_spirit;
+using namespace std;
+
+/** Longest request line accepted from a worker */
+static const unsigned int MAX_STRATUM_LINE = 16 * 1024;
+
+CStratumJob::CStratumJob(const std::string& strIdIn, const CBlock& blockIn, CBlockIndex* pindexPrevIn, int nHeight) :
+    strId(strIdIn), block(blockIn), pindexPrev(pindexPrevIn)
+{
+    // Height first as in IncrementExtraNonce, then a push holding both extra nonces
+    CScript scriptHeight = CScript() << nHeight;
+    CMutableTransaction txCoinbase(block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = (scriptHeight << std::vector<unsigned char>(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0)) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+    block.vtx[0] = txCoinbase;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block.vtx[0];
+    // nVersion, vin count, prevout, scriptSig length, height, push opcode
+    unsigned int nOffset = 4 + 1 + 36 + GetSizeOfCompactSize(txCoinbase.vin[0].scriptSig.size()) + (CScript() << nHeight).size() + 1;
+    vCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    vCoinbase2.assign(ss.begin() + nOffset + STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, ss.end());
+
+    block.BuildMerkleTree();
+    vMerkleBranch = block.GetMerkleBranch(0);
+}
+
+CBlock CStratumJob::GetBlock(const std::vector<unsigned char>& vExtraNonce1, const std::vector<unsigned char>& vExtraNonce2, uint32_t nTime, uint32_t nNonce) const
+{
+    std::vector<unsigned char> vCoinbase(vCoinbase1);
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce1.begin(), vExtraNonce1.end());
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce2.begin(), vExtraNonce2.end());
+    vCoinbase.insert(vCoinbase.end(), vCoinbase2.begin(), vCoinbase2.end());
+    CDataStream ss(vCoinbase, SER_NETWORK, PROTOCOL_VERSION);
+
+    CBlock blockRet(block);
+    CTransaction txCoinbase;
+    ss >> txCoinbase;
+    blockRet.vtx[0] = txCoinbase;
+    blockRet.hashMerkleRoot = CBlock::CheckMerkleBranch(txCoinbase.GetHash(), vMerkleBranch, 0);
+    blockRet.nTime = nTime;
+    blockRet.nNonce = nNonce;
+    return blockRet;
+}
+
+namespace {
+
+/** A connected Stratum worker */
+class CStratumClient
+{
+public:
+    SOCKET hSocket;
+    CService addr;
+    std::vector<unsigned char> vExtraNonce1;
+    std::string strRecv;
+    std::string strSend;
+    bool fSubscribed;
+    bool fDisconnect;
+    //! Shares already submitted, by job
+    std::map<std::string, std::set<uint256> > mapShares;
+
+    CStratumClient(SOCKET hSocketIn, const CService& addrIn, uint32_t nExtraNonce1) :
+        hSocket(hSocketIn), addr(addrIn), fSubscribed(false), fDisconnect(false)
+    {
+        vExtraNonce1.resize(STRATUM_EXTRANONCE1_SIZE);
+        WriteBE32(&vExtraNonce1[0], nExtraNonce1);
+    }
+
+    void Push(const Object& obj)
+    {
+        strSend += write_string(Value(obj), false) + "\n";
+    }
+};
+
+SOCKET hListenSocket = INVALID_SOCKET;
+CScript scriptPayout;
+uint256 hashShareTarget;
+unsigned int nShareDifficulty;
+
+std::list<CStratumClient> lClients;
+//! Jobs on top of the current tip, by id
+std::map<std::string, CStratumJob> mapJobs;
+std::string strCurrentJob;
+CBlockIndex* pindexJobPrev = NULL;
+unsigned int nJobTransactionsUpdated = 0;
+int64_t nJobTime = 0;
+unsigned int nJobId = 0;
+uint32_t nNextExtraNonce1 = 0;
+
+/** Stratum sends the previous block hash as eight 32 bit words in reversed byte order */
+std::string HexPrevHash(const uint256& hash)
+{
+    unsigned char buf[32];
+    for (int i = 0; i < 32; i += 4)
+        for (int j = 0; j < 4; j++)
+            buf[i + j] = BEGIN(hash)[i + 3 - j];
+    return HexStr(buf, buf + 32);
+}
+
+std::string HexBE32(uint32_t x)
+{
+    return strprintf("%08x", x);
+}
+
+bool ParseHexBE32(const Value& value, uint32_t& x)
+{
+    if (value.type() != str_type || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    std::vector<unsigned char> vch = ParseHex(value.get_str());
+    x = ReadBE32(&vch[0]);
+    return true;
+}
+
+/** Stratum errors are [code, message, traceback] */
+Array StratumError(int nCode, const std::string& strMessage)
+{
+    Array error;
+    error.push_back(nCode);
+    error.push_back(strMessage);
+    error.push_back(Value::null);
+    return error;
+}
+
+Object StratumReply(const Value& id, const Value& result, const Value& error)
+{
+    Object reply;
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", error));
+    return reply;
+}
+
+Object StratumNotify(const CStratumJob& job, bool fClean)
+{
+    Array branch;
+    BOOST_FOREACH(const uint256& hash, job.vMerkleBranch)
+        branch.push_back(HexStr(BEGIN(hash), END(hash)));
+
+    Array params;
+    params.push_back(job.strId);
+    params.push_back(HexPrevHash(job.block.hashPrevBlock));
+    params.push_back(HexStr(job.vCoinbase1));
+    params.push_back(HexStr(job.vCoinbase2));
+    params.push_back(branch);
+    params.push_back(HexBE32(job.block.nVersion));
+    params.push_back(HexBE32(job.block.nBits));
+    params.push_back(HexBE32(job.block.nTime));
+    params.push_back(fClean);
+
+    Object notify;
+    notify.push_back(Pair("id", Value::null));
+    notify.push_back(Pair("method", "mining.notify"));
+    notify.push_back(Pair("params", params));
+    return notify;
+}
+
+Object StratumSetDifficulty()
+{
+    Array params;
+    params.push_back((int)nShareDifficulty);
+    Object obj;
+    obj.push_back(Pair("id", Value::null));
+    obj.push_back(Pair("method", "mining.set_difficulty"));
+    obj.push_back(Pair("params", params));
+    return obj;
+}
+
+/** Forget the shares submitted for jobs that were dropped */
+void EraseStaleShares()
+{
+    BOOST_FOREACH(CStratumClient& client, lClients) {
+        std::map<std::string, std::set<uint256> >::iterator it = client.mapShares.begin();
+        while (it != client.mapShares.end()) {
+            if (mapJobs.count(it->first))
+                it++;
+            else
+                client.mapShares.erase(it++);
+        }
+    }
+}
+
+/** Build a new job when the tip changed, or the mempool did for a while. Returns whether one was made. */
+bool UpdateStratumJob(bool& fClean)
+{
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    bool fNewTip = pindexPrev != pindexJobPrev;
+    if (!fNewTip && (mempool.GetTransactionsUpdated() == nJobTransactionsUpdated || GetTime() - nJobTime < 30))
+        return false;
+    // Work on the old tip is worthless, even when there is nothing to replace it with yet
+    if (fNewTip) {
+        mapJobs.clear();
+        EraseStaleShares();
+    }
+    if (IsInitialBlockDownload() || (vNodes.empty() && Params().MiningRequiresPeers()))
+        return false;
+
+    // Same limits as getblocktemplate: no templates for heights the clock doesn't allow yet
+    unsigned int nHeightMaxNext = ((pindexPrev->GetBlockTime() - Params().GenesisBlock().GetBlockTime() + Params().TargetSpacing())/Params().TargetSpacing());
+    unsigned int nHeightMaxnTime = ((GetAdjustedTime() - Params().GenesisBlock().GetBlockTime() + Params().TargetSpacing())/Params().TargetSpacing());
+    if (pindexPrev->nHeight + 1 > (int)nHeightMaxNext || pindexPrev->nHeight + 1 > (int)nHeightMaxnTime)
+        return false;
+
+    // A template that fails is only retried once the mempool changes
+    pindexJobPrev = pindexPrev;
+    nJobTransactionsUpdated = mempool.GetTransactionsUpdated();
+    nJobTime = GetTime();
+    auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPayout));
+    if (!pblocktemplate.get())
+        return false;
+
+    // Workers must drop their old jobs if none of them is still valid
+    fClean = mapJobs.empty();
+    strCurrentJob = strprintf("%x", ++nJobId);
+    mapJobs[strCurrentJob] = CStratumJob(strCurrentJob, pblocktemplate->block, pindexPrev, pindexPrev->nHeight + 1);
+    if (nJobId > MAX_STRATUM_JOBS && mapJobs.erase(strprintf("%x", nJobId - MAX_STRATUM_JOBS)))
+        EraseStaleShares();
+    LogPrint("stratum", "Stratum: new job %s with %u transactions%s\n", strCurrentJob, pblocktemplate->block.vtx.size(), fClean ? " on a new tip" : "");
+    return true;
+}
+
+Value StratumSubmit(CStratumClient& client, const Array& params)
+{
+    if (params.size() < 5 || params[1].type() != str_type || params[2].type() != str_type)
+        return StratumError(20, "Invalid parameters");
+    std::map<std::string, CStratumJob>::const_iterator it = mapJobs.find(params[1].get_str());
+    if (it == mapJobs.end())
+        return StratumError(21, "Job not found");
+    const CStratumJob& job = it->second;
+
+    std::vector<unsigned char> vExtraNonce2 = ParseHex(params[2].get_str());
+    uint32_t nTime, nNonce;
+    if (vExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE || !ParseHexBE32(params[3], nTime) || !ParseHexBE32(params[4], nNonce))
+        return StratumError(20, "Invalid parameters");
+    if (nTime < job.block.nTime || nTime > GetAdjustedTime() + 2 * 60 * 60)
+        return StratumError(20, "Time out of range");
+
+    CBlock block = job.GetBlock(client.vExtraNonce1, vExtraNonce2, nTime, nNonce);
+    uint256 hash = block.GetPoWHash();
+    if (hash > hashShareTarget)
+        return StratumError(23, "Low difficulty share");
+    if (!client.mapShares[job.strId].insert(block.GetHash()).second)
+        return StratumError(22, "Duplicate share");
+
+    if (CheckProofOfWork(hash, block.nBits)) {
+        LogPrintf("Stratum: block found by %s\n  powhash: %s\n", client.addr.ToString(), hash.GetHex());
+        CValidationState state;
+        if (!ProcessNewBlock(state, NULL, &block))
+            LogPrintf("Stratum: ProcessNewBlock, block not accepted: %s\n", state.GetRejectReason());
+    }
+    return true;
+}
+
+void StratumProcessLine(CStratumClient& client, const std::string& strLine)
+{
+    Value valRequest;
+    if (!read_string(strLine, valRequest) || valRequest.type() != obj_type) {
+        client.fDisconnect = true;
+        return;
+    }
+    const Object& request = valRequest.get_obj();
+    const Value& id = find_value(request, "id");
+    const Value& method = find_value(request, "method");
+    const Value& params = find_value(request, "params");
+    if (method.type() != str_type) {
+        client.fDisconnect = true;
+        return;
+    }
+    const std::string& strMethod = method.get_str();
+    Array vParams = params.type() == array_type ? params.get_array() : Array();
+
+    if (strMethod == "mining.subscribe") {
+        Array subscription;
+        subscription.push_back("mining.notify");
+        subscription.push_back(HexStr(client.vExtraNonce1));
+        Array subscriptions;
+        subscriptions.push_back(subscription);
+        Array result;
+        result.push_back(subscriptions);
+        result.push_back(HexStr(client.vExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        client.Push(StratumReply(id, result, Value::null));
+        client.fSubscribed = true;
+        client.Push(StratumSetDifficulty());
+        if (mapJobs.count(strCurrentJob))
+            client.Push(StratumNotify(mapJobs[strCurrentJob], true));
+    } else if (strMethod == "mining.authorize") {
+        // Access is limited by -stratumbind, any worker name is accepted
+        client.Push(StratumReply(id, true, Value::null));
+    } else if (strMethod == "mining.submit") {
+        if (!client.fSubscribed) {
+            client.Push(StratumReply(id, Value::null, StratumError(25, "Not subscribed")));
+            return;
+        }
+        Value result = StratumSubmit(client, vParams);
+        if (result.type() == bool_type)
+            client.Push(StratumReply(id, result, Value::null));
+        else
+            client.Push(StratumReply(id, false, result));
+    } else {
+        client.Push(StratumReply(id, Value::null, StratumError(20, "Method not supported")));
+    }
+}
+
+void StratumCloseSockets()
+{
+    BOOST_FOREACH(CStratumClient& client, lClients)
+        CloseSocket(client.hSocket);
+    lClients.clear();
+    CloseSocket(hListenSocket);
+}
+
+void ThreadStratumServer()
+{
+    RenameThread("lavrovcoin-stratum");
+
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+
+            bool fClean;
+            bool fNewJob = false;
+            try {
+                fNewJob = UpdateStratumJob(fClean);
+            } catch (const std::runtime_error& e) {
+                LogPrintf("Stratum: failed to create a job: %s\n", e.what());
+            }
+            if (fNewJob) {
+                Object notify = StratumNotify(mapJobs[strCurrentJob], fClean);
+                BOOST_FOREACH(CStratumClient& client, lClients)
+                    if (client.fSubscribed)
+                        client.Push(notify);
+            }
+
+            struct timeval timeout;
+            timeout.tv_sec  = 0;
+            timeout.tv_usec = 50000;
+
+            fd_set fdsetRecv;
+            fd_set fdsetSend;
+            FD_ZERO(&fdsetRecv);
+            FD_ZERO(&fdsetSend);
+            SOCKET hSocketMax = hListenSocket;
+            FD_SET(hListenSocket, &fdsetRecv);
+            BOOST_FOREACH(const CStratumClient& client, lClients) {
+                FD_SET(client.hSocket, &fdsetRecv);
+                if (!client.strSend.empty())
+                    FD_SET(client.hSocket, &fdsetSend);
+                hSocketMax = max(hSocketMax, client.hSocket);
+            }
+
+            if (select(hSocketMax + 1, &fdsetRecv, &fdsetSend, NULL, &timeout) == SOCKET_ERROR)
+            {
+                LogPrintf("Stratum: select failed: %s\n", NetworkErrorString(WSAGetLastError()));
+                MilliSleep(50);
+                continue;
+            }
+
+            if (FD_ISSET(hListenSocket, &fdsetRecv))
+            {
+                struct sockaddr_storage sockaddr;
+                socklen_t len = sizeof(sockaddr);
+                SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
+                CService addr;
+                if (hSocket != INVALID_SOCKET && (!addr.SetSockAddr((const struct sockaddr*)&sockaddr) || !IsSelectableSocket(hSocket)))
+                    CloseSocket(hSocket);
+                if (hSocket != INVALID_SOCKET) {
+                    LogPrint("stratum", "Stratum: accepted connection from %s\n", addr.ToString());
+                    lClients.push_back(CStratumClient(hSocket, addr, nNextExtraNonce1++));
+                }
+            }
+
+            BOOST_FOREACH(CStratumClient& client, lClients)
+            {
+                if (FD_ISSET(client.hSocket, &fdsetRecv))
+                {
+                    char pchBuf[0x10000];
+                    int nBytes = recv(client.hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                    if (nBytes > 0) {
+                        client.strRecv.append(pchBuf, nBytes);
+                        size_t nPos;
+                        while (!client.fDisconnect && (nPos = client.strRecv.find('\n')) != std::string::npos) {
+                            std::string strLine = client.strRecv.substr(0, nPos);
+                            client.strRecv.erase(0, nPos + 1);
+                            StratumProcessLine(client, strLine);
+                        }
+                        if (client.strRecv.size() > MAX_STRATUM_LINE)
+                            client.fDisconnect = true;
+                    } else if (nBytes == 0 || (WSAGetLastError() != WSAEWOULDBLOCK && WSAGetLastError() != WSAEMSGSIZE && WSAGetLastError() != WSAEINTR && WSAGetLastError() != WSAEINPROGRESS)) {
+                        client.fDisconnect = true;
+                    }
+                }
+                if (FD_ISSET(client.hSocket, &fdsetSend) && !client.strSend.empty())
+                {
+                    int nBytes = send(client.hSocket, client.strSend.data(), client.strSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                    if (nBytes > 0)
+                        client.strSend.erase(0, nBytes);
+                    else if (WSAGetLastError() != WSAEWOULDBLOCK && WSAGetLastError() != WSAEMSGSIZE && WSAGetLastError() != WSAEINTR && WSAGetLastError() != WSAEINPROGRESS)
+                        client.fDisconnect = true;
+                }
+            }
+
+            for (std::list<CStratumClient>::iterator it = lClients.begin(); it != lClients.end(); ) {
+                if (it->fDisconnect) {
+                    LogPrint("stratum", "Stratum: disconnecting %s\n", it->addr.ToString());
+                    CloseSocket(it->hSocket);
+                    it = lClients.erase(it);
+                } else
+                    it++;
+            }
+        }
+    }
+    catch (boost::thread_interrupted)
+    {
+        StratumCloseSockets();
+        throw;
+    }
+}
+
+} // anon namespace
+
+bool StartStratumServer(boost::thread_group& threadGroup, std::string& strError)
+{
+    CBitcoinAddress address(GetArg("-stratumaddress", ""));
+    if (!address.IsValid()) {
+        strError = _("-stratum requires a valid -stratumaddress to pay mined blocks to");
+        return false;
+    }
+    scriptPayout = GetScriptForDestination(address.Get());
+
+    nShareDifficulty = std::max((int64_t)1, GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY));
+    // Difficulty 1 is the usual scrypt pool share target 0x0000ffff << 224
+    hashShareTarget = (uint256(0xffff) << 224) / uint256(nShareDifficulty);
+
+    CService addrBind;
+    std::string strBind = GetArg("-stratumbind", "127.0.0.1");
+    if (!Lookup(strBind.c_str(), addrBind, GetArg("-stratumport", DEFAULT_STRATUM_PORT), false)) {
+        strError = strprintf(_("Cannot resolve -stratumbind address: '%s'"), strBind);
+        return false;
+    }
+
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+        strError = strprintf(_("Bind address family for %s not supported"), addrBind.ToString());
+        return false;
+    }
+    hListenSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (hListenSocket == INVALID_SOCKET || !IsSelectableSocket(hListenSocket)) {
+        strError = strprintf(_("Couldn't open socket for Stratum connections (%s)"), NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+
+    int nOne = 1;
+#ifndef WIN32
+    setsockopt(hListenSocket, SOL_SOCKET, SO_REUSEADDR, (void*)&nOne, sizeof(int));
+    setsockopt(hListenSocket, IPPROTO_TCP, TCP_NODELAY, (void*)&nOne, sizeof(int));
+#else
+    setsockopt(hListenSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&nOne, sizeof(int));
+    setsockopt(hListenSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&nOne, sizeof(int));
+#endif
+    // Accepted sockets inherit non-blocking mode
+    if (!SetSocketNonBlocking(hListenSocket, true) ||
+        ::bind(hListenSocket, (struct sockaddr*)&sockaddr, len) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR)
+    {
+        strError = strprintf(_("Unable to bind to %s for Stratum connections (error %s)"), addrBind.ToString(), NetworkErrorString(WSAGetLastError()));
+        CloseSocket(hListenSocket);
+        return false;
+    }
+
+    LogPrintf("Stratum: listening on %s, share difficulty %u\n", addrBind.ToString(), nShareDifficulty);
+    threadGroup.create_thread(&ThreadStratumServer);
+    return true;
+}
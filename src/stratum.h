@@ -0,0 +1,52 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+class CBlockIndex;
+
+static const unsigned short DEFAULT_STRATUM_PORT = 8643;
+static const unsigned int DEFAULT_STRATUM_DIFFICULTY = 1;
+/** Sizes of the extra nonce assigned per connection and of the one chosen by the worker */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+/** Jobs kept on one tip; shares for older ones are rejected as stale */
+static const unsigned int MAX_STRATUM_JOBS = 4;
+
+/**
+ * A unit of work handed to Stratum workers: a block template whose coinbase
+ * is split in two around the extra nonces, and the merkle branch that links
+ * the coinbase to the merkle root.
+ */
+class CStratumJob
+{
+public:
+    std::string strId;
+    CBlock block;
+    CBlockIndex* pindexPrev;
+    std::vector<unsigned char> vCoinbase1;
+    std::vector<unsigned char> vCoinbase2;
+    std::vector<uint256> vMerkleBranch;
+
+    CStratumJob() : pindexPrev(NULL) {}
+    /** Make room for the extra nonces in the template's coinbase and split it */
+    CStratumJob(const std::string& strIdIn, const CBlock& blockIn, CBlockIndex* pindexPrevIn, int nHeight);
+
+    /** The block a worker solved with the given extra nonces, time and nonce */
+    CBlock GetBlock(const std::vector<unsigned char>& vExtraNonce1, const std::vector<unsigned char>& vExtraNonce2, uint32_t nTime, uint32_t nNonce) const;
+};
+
+/** Start the Stratum server thread if -stratum is set */
+bool StartStratumServer(boost::thread_group& threadGroup, std::string& strError);
+
+#endif // BITCOIN_STRATUM_H
@@ -6,6 +6,8 @@
 
 #include "allocators.h"
 
+#include <map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(allocator_tests)
@@ -116,4 +118,44 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(test_PoolResource)
+{
+    CPoolResource pool;
+    BOOST_CHECK(pool.MemoryUsage() == 0);
+
+    // Freed allocations are handed out again, for the same size class only
+    void* p1 = pool.Allocate(40);
+    void* p2 = pool.Allocate(40);
+    BOOST_CHECK(p1 != p2);
+    BOOST_CHECK(reinterpret_cast<size_t>(p1) % CPoolResource::POOL_ALIGN == 0);
+    pool.Deallocate(p1, 40);
+    BOOST_CHECK(pool.FreeMemory() == (40 + CPoolResource::POOL_ALIGN - 1) / CPoolResource::POOL_ALIGN * CPoolResource::POOL_ALIGN);
+    BOOST_CHECK(pool.Allocate(8 * CPoolResource::POOL_ALIGN) != p1);
+    BOOST_CHECK(pool.Allocate(40) == p1);
+    BOOST_CHECK(pool.FreeMemory() == 0);
+    BOOST_CHECK(pool.MemoryUsage() == CPoolResource::MIN_CHUNK_SIZE);
+
+    // Chunks grow up to the maximum size
+    for (int i = 0; i < 100000; i++)
+        pool.Allocate(CPoolResource::MAX_POOLED_SIZE);
+    BOOST_CHECK(pool.MemoryUsage() >= 100000 * CPoolResource::MAX_POOLED_SIZE);
+    BOOST_CHECK(pool.MemoryUsage() < 100000 * CPoolResource::MAX_POOLED_SIZE + 2 * CPoolResource::MAX_CHUNK_SIZE);
+
+    // Node based containers work with it, and keep their contents
+    typedef std::map<int, int, std::less<int>, pool_allocator<std::pair<const int, int> > > PooledMap;
+    std::less<int> comp;
+    PooledMap mapPooled(comp, PooledMap::allocator_type(&pool));
+    for (int i = 0; i < 10000; i++)
+        mapPooled[i] = i * 2;
+    for (int i = 0; i < 10000; i += 2)
+        mapPooled.erase(i);
+    for (int i = 10000; i < 15000; i++)
+        mapPooled[i] = i * 2;
+    BOOST_CHECK(mapPooled.size() == 10000);
+    for (PooledMap::const_iterator it = mapPooled.begin(); it != mapPooled.end(); it++) {
+        BOOST_CHECK(it->first >= 10000 || it->first % 2 == 1);
+        BOOST_CHECK(it->second == it->first * 2);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/** Counts how often checks ran, and fails if told to */
+class CCountingCheck
+{
+private:
+    static boost::mutex mutex;
+    static unsigned int nRun;
+    bool fOk;
+
+public:
+    CCountingCheck() : fOk(true) {}
+    explicit CCountingCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nRun++;
+        return fOk;
+    }
+
+    void swap(CCountingCheck& check) { std::swap(fOk, check.fOk); }
+
+    static unsigned int Reset()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        unsigned int nRet = nRun;
+        nRun = 0;
+        return nRet;
+    }
+};
+
+boost::mutex CCountingCheck::mutex;
+unsigned int CCountingCheck::nRun = 0;
+
+const unsigned int nWorkers = 3;
+
+CCheckQueue<CCountingCheck> queue(16, nWorkers);
+
+void RunWorker()
+{
+    queue.Thread();
+}
+
+/** Queue nChecks checks in batches of nBatch, the one at nFail (if any) failing, and wait */
+bool RunChecks(unsigned int nChecks, unsigned int nBatch, unsigned int nFail)
+{
+    CCheckQueueControl<CCountingCheck> control(&queue);
+    for (unsigned int i = 0; i < nChecks; i += nBatch) {
+        std::vector<CCountingCheck> vChecks;
+        for (unsigned int j = i; j < std::min(nChecks, i + nBatch); j++)
+            vChecks.push_back(CCountingCheck(j != nFail));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_all)
+{
+    boost::thread_group threadGroup;
+    for (unsigned int i = 0; i < nWorkers; i++)
+        threadGroup.create_thread(&RunWorker);
+
+    // Everything passing is run exactly once, whether added one by one or in bulk
+    const unsigned int nBatches[] = {1, 7, 100, 5000};
+    for (unsigned int i = 0; i < sizeof(nBatches) / sizeof(nBatches[0]); i++) {
+        CCountingCheck::Reset();
+        BOOST_CHECK(RunChecks(5000, nBatches[i], (unsigned int)-1));
+        BOOST_CHECK_EQUAL(CCountingCheck::Reset(), 5000U);
+
+        std::vector<CCheckQueueWorkerStats> vStats;
+        queue.GetStats(vStats);
+        unsigned int nTotal = 0;
+        for (unsigned int j = 0; j < vStats.size(); j++)
+            nTotal += vStats[j].nChecks;
+        BOOST_CHECK_EQUAL(nTotal, 5000U);
+        BOOST_CHECK(vStats.size() <= nWorkers + 1);
+    }
+
+    // A single failure is reported, and the queue is usable again afterwards
+    for (unsigned int nFail = 0; nFail < 5000; nFail += 1237) {
+        BOOST_CHECK(!RunChecks(5000, 100, nFail));
+        BOOST_CHECK(CCountingCheck::Reset() <= 5000U);
+        BOOST_CHECK(RunChecks(100, 10, (unsigned int)-1));
+        BOOST_CHECK_EQUAL(CCountingCheck::Reset(), 100U);
+    }
+
+    // An empty round succeeds
+    BOOST_CHECK(RunChecks(0, 1, (unsigned int)-1));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
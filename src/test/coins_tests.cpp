@@ -3,13 +3,19 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "hash.h"
+#include "main.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 namespace
 {
@@ -41,23 +47,176 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // What the cache remembered of our version must match it
+                std::vector<unsigned char> vMask;
+                if (map_.count(it->first))
+                    map_[it->first].GetUnspentMask(vMask);
+                if (it->second.flags & CCoinsCacheEntry::FRESH)
+                    BOOST_CHECK(!map_.count(it->first) || map_[it->first].IsPruned());
+                else {
+                    BOOST_CHECK(vMask == it->second.vBaseUnspent);
+                    BOOST_CHECK_EQUAL(map_[it->first].nHeight, it->second.nBaseHeight);
+                }
+            }
             map_[it->first] = it->second.coins;
             if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
                 // Randomly delete empty entries on write.
                 map_.erase(it->first);
             }
-            mapCoins.erase(it++);
+            if (fErase)
+                mapCoins.erase(it++);
+            else
+                it++;
         }
-        mapCoins.clear();
+        if (fErase)
+            mapCoins.clear();
         hashBestBlock_ = hashBlock;
         return true;
     }
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    //! Check that the incrementally tracked memory usage matches a full recount
+    void SelfTest() const
+    {
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++)
+            ret += it->second.coins.DynamicMemoryUsage() + memusage::DynamicUsage(it->second.vBaseUnspent);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+//! In-memory coin database that can also hold records as they were before CCoinsViewDB::Upgrade()
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    void WriteLegacy(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+    }
+
+    void WriteBestBlock(const uint256& hashBlock)
+    {
+        db.Write('B', hashBlock);
+    }
+
+    bool HaveLegacy() const
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewReadIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << std::make_pair('c', uint256(0));
+        pcursor->Seek(ssKeySet.str());
+        return pcursor->Valid() && pcursor->key()[0] == 'c';
+    }
+
+    //! What GetStats() hashed the records of a database that wasn't upgraded to
+    uint256 GetLegacyHash() const
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewReadIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << std::make_pair('c', uint256(0));
+        pcursor->Seek(ssKeySet.str());
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << GetBestBlock();
+        for (; pcursor->Valid() && pcursor->key()[0] == 'c'; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txid;
+            ssKey >> chType >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            ss << txid << VARINT(coins.nVersion) << (coins.fCoinBase ? 'c' : 'n') << VARINT(coins.nHeight);
+            for (unsigned int i = 0; i < coins.vout.size(); i++)
+                if (!coins.vout[i].IsNull())
+                    ss << VARINT(i+1) << coins.vout[i];
+            ss << VARINT(0);
+        }
+        return ss.GetHash();
+    }
+};
+
+//! Serializes access to a view that isn't thread safe, as the database is
+class CCoinsViewLocked : public CCoinsViewBacked
+{
+    mutable boost::mutex mutex;
+
+public:
+    CCoinsViewLocked(CCoinsView* view) : CCoinsViewBacked(view) {}
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return base->GetCoins(txid, coins);
+    }
+
+    bool HaveCoins(const uint256& txid) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return base->HaveCoins(txid);
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return base->BatchWrite(mapCoins, hashBlock, fErase);
+    }
+};
+
+//! Holds writes from other threads back until let through, to look at what is read while they are in progress
+class CCoinsViewGate : public CCoinsViewBacked
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fOpen;
+    bool fHolding;
+    boost::thread::id idOwner;
+
+public:
+    CCoinsViewGate(CCoinsView* view) : CCoinsViewBacked(view), fOpen(false), fHolding(false), idOwner(boost::this_thread::get_id()) {}
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+    {
+        if (boost::this_thread::get_id() != idOwner) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fHolding = true;
+            while (!fOpen)
+                cond.wait(lock);
+            fOpen = false;
+            fHolding = false;
+        }
+        return base->BatchWrite(mapCoins, hashBlock, fErase);
+    }
+
+    //! Whether a write is being held back
+    bool IsHolding()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fHolding;
+    }
+
+    //! Let the next write through
+    void Open()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fOpen = true;
+        cond.notify_all();
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,14 +242,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool trimmed_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +275,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                // Scripts of varying size, so the memory usage changes
+                coins.vout[0].scriptPubKey.assign(insecure_rand() % 100, 0);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,6 +297,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -143,6 +308,13 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 stack.back()->Flush();
                 delete stack.back();
                 stack.pop_back();
+            } else if (stack.size() > 0 && insecure_rand() % 2 == 0) {
+                // Write the tip out but keep it, and evict about half of it
+                size_t nTarget = stack.back()->DynamicMemoryUsageInUse() / 2;
+                BOOST_CHECK(stack.back()->Sync());
+                stack.back()->Trim(nTarget);
+                BOOST_CHECK(stack.back()->DynamicMemoryUsageInUse() <= nTarget || stack.back()->GetCacheSize() == 0);
+                trimmed_a_cache = true;
             }
             if (stack.size() == 0 || (stack.size() < 4 && insecure_rand() % 2)) {
                 CCoinsView* tip = &base;
@@ -151,7 +323,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -173,6 +345,268 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(trimmed_a_cache);
+}
+
+// A database with a record per transaction keeps its coins, and what they hash
+// to, when upgraded. From then on the outputs are written one by one.
+BOOST_AUTO_TEST_CASE(coins_db_upgrade_test)
+{
+    uint256 hashBest = chainActive.Genesis()->GetBlockHash();
+    std::vector<uint256> vTxid;
+    std::map<uint256, CCoins> mapFull;
+    std::map<uint256, CCoins> result;
+    CCoinsViewDBTest db;
+    db.WriteBestBlock(hashBest);
+    // More than the 10000 transactions Upgrade() writes at a time
+    for (unsigned int i = 0; i < 12000; i++) {
+        vTxid.push_back(GetRandHash());
+        CCoins& coins = mapFull[vTxid.back()];
+        coins.nVersion = 1 + i % 2;
+        coins.fCoinBase = i % 3 == 0;
+        coins.nHeight = i;
+        coins.vout.resize(1 + insecure_rand() % 10);
+        for (unsigned int j = 0; j < coins.vout.size(); j++) {
+            coins.vout[j].nValue = insecure_rand();
+            coins.vout[j].scriptPubKey.assign(1 + insecure_rand() % 30, (unsigned char)j);
+        }
+        // Partly spent, with the trailing spent outputs left out
+        result[vTxid.back()] = coins;
+        for (unsigned int j = 1; j < coins.vout.size(); j++)
+            if (insecure_rand() % 3 == 0)
+                result[vTxid.back()].Spend(j);
+        db.WriteLegacy(vTxid.back(), result[vTxid.back()]);
+    }
+
+    uint256 hashLegacy = db.GetLegacyHash();
+    BOOST_CHECK(db.HaveLegacy());
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacy());
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(stats.hashSerialized == hashLegacy);
+    BOOST_CHECK_EQUAL(stats.nTransactions, result.size());
+    BOOST_CHECK(db.GetBestBlock() == hashBest);
+
+    bool fMatch = true;
+    for (unsigned int nRound = 0; nRound < 5; nRound++) {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < 2000; i++) {
+            const uint256& txid = vTxid[insecure_rand() % vTxid.size()];
+            const CCoins& full = mapFull[txid];
+            CCoins& coins = result[txid];
+            CCoinsModifier entry = cache.ModifyCoins(txid);
+            if (!(*entry == coins)) {
+                fMatch = false;
+                break;
+            }
+            unsigned int nPos = insecure_rand() % full.vout.size();
+            if (coins.IsPruned()) {
+                // Created again, at another height
+                coins = full;
+                coins.nHeight = 20000 + nRound;
+                *entry = coins;
+            } else if (nPos >= coins.vout.size() || coins.vout[nPos].IsNull()) {
+                // Unspent again, as disconnecting a block does, possibly past the last unspent output
+                if (nPos >= coins.vout.size()) {
+                    coins.vout.resize(nPos + 1);
+                    entry->vout.resize(nPos + 1);
+                }
+                coins.vout[nPos] = full.vout[nPos];
+                entry->vout[nPos] = full.vout[nPos];
+            } else {
+                // Spent, which may be the last unspent output
+                coins.Spend(nPos);
+                entry->Spend(nPos);
+            }
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(fMatch);
+    for (std::map<uint256, CCoins>::const_iterator it = result.begin(); it != result.end(); it++) {
+        CCoins coins;
+        if (db.GetCoins(it->first, coins))
+            fMatch &= coins == it->second && db.HaveCoins(it->first);
+        else
+            fMatch &= it->second.IsPruned() && !db.HaveCoins(it->first);
+    }
+    BOOST_CHECK(fMatch);
+
+    // What it hashes to is still what a database with a record per transaction would
+    CCoinsViewDBTest dbLegacy;
+    dbLegacy.WriteBestBlock(hashBest);
+    for (std::map<uint256, CCoins>::const_iterator it = result.begin(); it != result.end(); it++)
+        if (!it->second.IsPruned())
+            dbLegacy.WriteLegacy(it->first, it->second);
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(stats.hashSerialized == dbLegacy.GetLegacyHash());
+}
+
+// Coins read ahead of time must never be handed out once a write changed them.
+BOOST_AUTO_TEST_CASE(coins_prefetch_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewLocked locked(&base);
+    std::vector<uint256> vTxid;
+    {
+        CCoinsViewCache cache(&locked);
+        for (unsigned int i = 0; i < 200; i++) {
+            vTxid.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(vTxid.back());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i;
+        }
+        cache.Flush();
+    }
+
+    CCoinsViewPrefetch prefetch(&locked);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, &prefetch));
+
+    for (unsigned int nRound = 0; nRound < 20; nRound++) {
+        prefetch.Prefetch(vTxid);
+        CCoinsViewCache cache(&prefetch);
+        // Read only some of them, leaving prefetched entries behind to be overwritten
+        for (unsigned int i = nRound % 2; i < vTxid.size(); i += 2) {
+            const CCoins* coins = cache.AccessCoins(vTxid[i]);
+            BOOST_CHECK(coins && coins->vout[0].nValue == i + 1000 * nRound);
+        }
+        {
+            CCoinsViewCache cacheWrite(&locked);
+            for (unsigned int i = 0; i < vTxid.size(); i++) {
+                CCoinsModifier coins = cacheWrite.ModifyCoins(vTxid[i]);
+                BOOST_CHECK_EQUAL(coins->vout[0].nValue, i + 1000 * nRound);
+                coins->vout[0].nValue += 1000;
+            }
+            // Written through the prefetch layer, as pcoinsTip does
+            CCoinsMap mapCoins;
+            for (unsigned int i = 0; i < vTxid.size(); i++) {
+                CCoinsCacheEntry& entry = mapCoins[vTxid[i]];
+                entry.coins = *cacheWrite.AccessCoins(vTxid[i]);
+                entry.coins.GetUnspentMask(entry.vBaseUnspent);
+                entry.nBaseHeight = entry.coins.nHeight;
+                entry.flags = CCoinsCacheEntry::DIRTY;
+            }
+            BOOST_CHECK(prefetch.BatchWrite(mapCoins, uint256(nRound + 1), true));
+        }
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+// Coins read while a write is in progress may be either version, and must be thrown away.
+BOOST_AUTO_TEST_CASE(coins_prefetch_during_write_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewLocked locked(&base);
+    CCoinsViewGate gate(&locked);
+    uint256 txid = GetRandHash();
+    {
+        CCoinsViewCache cache(&locked);
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+        cache.Flush();
+    }
+
+    CCoinsViewPrefetch prefetch(&gate);
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, &prefetch));
+
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry& entry = mapCoins[txid];
+    BOOST_CHECK(base.GetCoins(txid, entry.coins));
+    entry.coins.GetUnspentMask(entry.vBaseUnspent);
+    entry.nBaseHeight = entry.coins.nHeight;
+    entry.coins.vout[0].nValue = 2;
+    entry.flags = CCoinsCacheEntry::DIRTY;
+    // Start a write from another thread, and hold it while the old version is prefetched
+    boost::thread threadWrite(boost::bind(&CCoinsViewPrefetch::BatchWrite, &prefetch, boost::ref(mapCoins), uint256(1), true));
+    while (!gate.IsHolding())
+        boost::this_thread::yield();
+    std::vector<uint256> vTxid(1, txid);
+    prefetch.Prefetch(vTxid);
+    while (!prefetch.IsIdle())
+        boost::this_thread::yield();
+    gate.Open();
+    threadWrite.join();
+
+    CCoins coins;
+    BOOST_CHECK(prefetch.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 2);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+// Coins handed to the background writer read back right away, and reach the base in order.
+BOOST_AUTO_TEST_CASE(coins_writebehind_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewLocked locked(&base);
+    CCoinsViewGate gate(&locked);
+    CCoinsViewWriteBehind writer(&gate);
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&CCoinsViewWriteBehind::ThreadWrite, &writer));
+    while (!writer.IsRunning())
+        boost::this_thread::yield();
+
+    std::vector<uint256> vTxid;
+    for (unsigned int i = 0; i < 100; i++)
+        vTxid.push_back(GetRandHash());
+    std::map<uint256, CCoins> result;
+    CCoinsViewCacheTest cache(&writer);
+    for (unsigned int nRound = 0; nRound < 50; nRound++) {
+        for (unsigned int i = 0; i < 50; i++) {
+            const uint256& txid = vTxid[insecure_rand() % vTxid.size()];
+            CCoins& coins = result[txid];
+            CCoinsModifier entry = cache.ModifyCoins(txid);
+            if (coins.IsPruned()) {
+                coins.nHeight = nRound;
+                coins.vout.resize(1 + insecure_rand() % 3);
+                for (unsigned int j = 0; j < coins.vout.size(); j++)
+                    coins.vout[j].nValue = insecure_rand();
+                *entry = coins;
+            } else {
+                unsigned int nPos = insecure_rand() % coins.vout.size();
+                coins.Spend(nPos);
+                entry->Spend(nPos);
+            }
+        }
+        cache.SetBestBlock(uint256(nRound + 1));
+        BOOST_CHECK(nRound % 5 == 4 ? cache.Flush() : cache.Sync());
+        // What the writer took is no longer counted by the cache, but by the writer
+        cache.SelfTest();
+        BOOST_CHECK(writer.DynamicMemoryUsage() > 0);
+
+        // The write is held back until we're done reading. Only check after
+        // it, as the base view uses the test framework too.
+        bool fMatch = writer.GetBestBlock() == uint256(nRound + 1);
+        for (std::map<uint256, CCoins>::const_iterator it = result.begin(); it != result.end(); it++) {
+            CCoins coins;
+            if (writer.GetCoins(it->first, coins) && !coins.IsPruned())
+                fMatch &= coins == it->second;
+            else
+                fMatch &= it->second.IsPruned();
+        }
+        gate.Open();
+        BOOST_CHECK(writer.Wait());
+        BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+        BOOST_CHECK(fMatch);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    BOOST_CHECK(base.GetBestBlock() == uint256(50));
+    for (std::map<uint256, CCoins>::const_iterator it = result.begin(); it != result.end(); it++) {
+        CCoins coins;
+        if (base.GetCoins(it->first, coins) && !coins.IsPruned())
+            BOOST_CHECK(coins == it->second);
+        else
+            BOOST_CHECK(it->second.IsPruned());
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
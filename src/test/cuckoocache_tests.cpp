@@ -0,0 +1,99 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+#include "uint256.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+class CTestHasher
+{
+public:
+    uint32_t operator()(const uint256& key, unsigned int n) const
+    {
+        uint32_t u;
+        memcpy(&u, key.begin() + 4 * n, 4);
+        return u;
+    }
+};
+
+uint256 RandomEntry()
+{
+    uint256 entry;
+    for (unsigned int i = 0; i < 8; i++) {
+        uint32_t u = insecure_rand();
+        memcpy(entry.begin() + 4 * i, &u, 4);
+    }
+    return entry;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(cuckoocache_tests)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hits)
+{
+    cuckoocache<uint256, CTestHasher> cache;
+    BOOST_CHECK(!cache.contains(RandomEntry(), false));
+    uint32_t nSize = cache.setup_bytes(1 << 16);
+    BOOST_CHECK_EQUAL(nSize, (1 << 16) / 32);
+
+    // Well below the generation size, everything stays
+    std::vector<uint256> vEntries;
+    for (uint32_t i = 0; i < nSize / 4; i++) {
+        vEntries.push_back(RandomEntry());
+        cache.insert(vEntries.back());
+    }
+    for (uint32_t i = 0; i < vEntries.size(); i++)
+        BOOST_CHECK(cache.contains(vEntries[i], false));
+
+    // Overfill it several times: the most recent entries are still found
+    for (uint32_t i = 0; i < 4 * nSize; i++) {
+        vEntries.push_back(RandomEntry());
+        cache.insert(vEntries.back());
+    }
+    unsigned int nHits = 0;
+    for (uint32_t i = vEntries.size() - nSize / 4; i < vEntries.size(); i++)
+        nHits += cache.contains(vEntries[i], false);
+    BOOST_CHECK(nHits >= nSize / 4 * 95 / 100);
+    for (uint32_t i = 0; i < 100; i++)
+        BOOST_CHECK(!cache.contains(RandomEntry(), false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    cuckoocache<uint256, CTestHasher> cache;
+    uint32_t nSize = cache.setup_bytes(1 << 16);
+
+    // Erased entries make room, so a cache kept a third full by erasing
+    // never loses an entry that was not erased
+    std::vector<uint256> vEntries;
+    for (uint32_t i = 0; i < 4 * nSize; i++) {
+        vEntries.push_back(RandomEntry());
+        cache.insert(vEntries.back());
+        if (i >= nSize / 3)
+            BOOST_CHECK(cache.contains(vEntries[i - nSize / 3], true));
+    }
+    for (uint32_t i = vEntries.size() - nSize / 3; i < vEntries.size(); i++)
+        BOOST_CHECK(cache.contains(vEntries[i], false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_disabled)
+{
+    cuckoocache<uint256, CTestHasher> cache;
+    BOOST_CHECK_EQUAL(cache.setup_bytes(0), 0);
+    uint256 entry = RandomEntry();
+    cache.insert(entry);
+    BOOST_CHECK(!cache.contains(entry, false));
+    BOOST_CHECK(!cache.contains(entry, true));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,9 +4,85 @@
 
 #include "primitives/transaction.h"
 #include "main.h"
+#include "coins.h"
+#include "script/script.h"
 
 #include <boost/test/unit_test.hpp>
 
+namespace
+{
+//! A block to connect on top of the active chain's tip, spending the outputs of a transaction in the UTXO set
+class CConnectBlockTest
+{
+public:
+    CCoinsView viewDummy;
+    CCoinsViewCache view;
+    CBlock block;
+    uint256 hashBlock;
+    CBlockIndex index;
+    uint256 hashFunding;
+
+    CConnectBlockTest() : view(&viewDummy)
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        block.nVersion = 1;
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.nTime = pindexPrev->nTime + 1;
+        block.nBits = pindexPrev->nBits;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(coinbase);
+
+        index.pprev = pindexPrev;
+        index.nHeight = pindexPrev->nHeight + 1;
+        view.SetBestBlock(pindexPrev->GetBlockHash());
+
+        hashFunding = GetRandHash();
+        CCoinsModifier coins = view.ModifyCoins(hashFunding);
+        coins->nVersion = 1;
+        coins->nHeight = 1;
+        coins->vout.resize(4);
+        for (unsigned int i = 0; i < coins->vout.size(); i++) {
+            coins->vout[i].nValue = 50 * COIN;
+            coins->vout[i].scriptPubKey = CScript() << OP_TRUE;
+        }
+    }
+
+    //! Append a transaction spending output n of hash
+    const CTransaction& Spend(const uint256& hash, uint32_t n, CAmount nValue)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(hash, n);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = nValue;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(tx);
+        return block.vtx.back();
+    }
+
+    bool Connect(CValidationState& state)
+    {
+        return Connect(state, view);
+    }
+
+    bool Connect(CValidationState& state, CCoinsViewCache& viewConnect)
+    {
+        LOCK(cs_main);
+        hashBlock = block.GetHash();
+        index.phashBlock = &hashBlock;
+        index.nTime = block.nTime;
+        return ConnectBlock(block, state, &index, viewConnect, true);
+    }
+};
+}
+
 BOOST_AUTO_TEST_SUITE(main_tests)
 
 BOOST_AUTO_TEST_CASE(subsidy_limit_test)
@@ -21,4 +97,111 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 8399999990760000ULL);
 }
 
+// Transactions may spend outputs of the ones before them in the block
+BOOST_AUTO_TEST_CASE(connectblock_spend_chain)
+{
+    CConnectBlockTest test;
+    uint256 hash = test.hashFunding;
+    for (unsigned int i = 0; i < 5; i++)
+        hash = test.Spend(hash, 0, (49 - i) * COIN).GetHash();
+    CValidationState state;
+    BOOST_CHECK(test.Connect(state));
+    BOOST_CHECK(test.view.HaveCoins(hash));
+    BOOST_CHECK(!test.view.AccessCoins(test.hashFunding)->IsAvailable(0));
+    BOOST_CHECK(test.view.AccessCoins(test.hashFunding)->IsAvailable(1));
+    for (unsigned int i = 1; i < test.block.vtx.size() - 1; i++)
+        BOOST_CHECK(!test.view.HaveCoins(test.block.vtx[i].GetHash()));
+}
+
+// Of two transactions spending the same output, the later one is invalid
+BOOST_AUTO_TEST_CASE(connectblock_double_spend)
+{
+    CConnectBlockTest test;
+    test.Spend(test.hashFunding, 1, 49 * COIN);
+    test.Spend(test.hashFunding, 2, 49 * COIN);
+    test.Spend(test.hashFunding, 1, 48 * COIN);
+    CValidationState state;
+    int nDoS = 0;
+    BOOST_CHECK(!test.Connect(state));
+    BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 100);
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-missingorspent");
+}
+
+// The block's own coinbase is as immature as any
+BOOST_AUTO_TEST_CASE(connectblock_premature_coinbase_spend)
+{
+    CConnectBlockTest test;
+    test.Spend(test.block.vtx[0].GetHash(), 0, 0);
+    CValidationState state;
+    BOOST_CHECK(!test.Connect(state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-premature-spend-of-coinbase");
+}
+
+// The failure reported is that of the first invalid transaction in the block
+BOOST_AUTO_TEST_CASE(connectblock_first_failure)
+{
+    {
+        CConnectBlockTest test;
+        test.Spend(test.hashFunding, 0, 49 * COIN);
+        test.Spend(test.hashFunding, 1, 51 * COIN);
+        test.Spend(test.block.vtx[0].GetHash(), 0, 0);
+        test.Spend(test.hashFunding, 0, 48 * COIN);
+        CValidationState state;
+        BOOST_CHECK(!test.Connect(state));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-in-belowout");
+    }
+    {
+        CConnectBlockTest test;
+        test.Spend(test.hashFunding, 0, 49 * COIN);
+        test.Spend(test.block.vtx[0].GetHash(), 0, 0);
+        test.Spend(test.hashFunding, 1, 51 * COIN);
+        test.Spend(test.hashFunding, 0, 48 * COIN);
+        CValidationState state;
+        BOOST_CHECK(!test.Connect(state));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-premature-spend-of-coinbase");
+    }
+    {
+        CConnectBlockTest test;
+        test.Spend(test.hashFunding, 0, 49 * COIN);
+        test.Spend(test.hashFunding, 0, 48 * COIN);
+        test.Spend(test.hashFunding, 1, 51 * COIN);
+        test.Spend(test.block.vtx[0].GetHash(), 0, 0);
+        CValidationState state;
+        BOOST_CHECK(!test.Connect(state));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-missingorspent");
+    }
+}
+
+// Checks for the mempool or a block template keep finding a pass stored earlier,
+// however often they look
+BOOST_AUTO_TEST_CASE(checkinputs_keeps_script_cache_entries)
+{
+    CConnectBlockTest test;
+    CTransaction tx = test.Spend(test.hashFunding, 0, 49 * COIN);
+    CValidationState state;
+    PrecomputedTransactionData txdata;
+    std::vector<CScriptCheck> vChecks;
+    LOCK(cs_main);
+    unsigned int flags = GetBlockScriptFlags(test.block.nVersion, test.block.nTime, chainActive.Tip());
+
+    // Not cached yet: the checks are handed out
+    BOOST_CHECK(CheckInputs(tx, state, test.view, true, flags, true, false, txdata, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    vChecks.clear();
+
+    // A pass run inline is remembered, and survives lookups that don't store
+    BOOST_CHECK(CheckInputs(tx, state, test.view, true, flags, true, true, txdata));
+    for (unsigned int i = 0; i < 2; i++) {
+        BOOST_CHECK(CheckInputs(tx, state, test.view, true, flags, true, false, txdata));
+        BOOST_CHECK(CheckInputs(tx, state, test.view, true, flags, true, false, txdata, &vChecks));
+        BOOST_CHECK(vChecks.empty());
+    }
+
+    // As does checking a block containing it without connecting it
+    CCoinsViewCache viewBlock(&test.view);
+    BOOST_CHECK(test.Connect(state, viewBlock));
+    BOOST_CHECK(CheckInputs(tx, state, test.view, true, flags, true, false, txdata, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -104,4 +104,58 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(pmt_mutated)
+{
+    for (unsigned int nTx = 1; nTx <= 40; nTx++) {
+        CBlock block;
+        for (unsigned int j=0; j<nTx; j++) {
+            CMutableTransaction tx;
+            tx.nLockTime = j;
+            block.vtx.push_back(CTransaction(tx));
+        }
+        bool fMutated;
+        uint256 merkleRoot1 = block.BuildMerkleTree(&fMutated);
+        BOOST_CHECK(!fMutated);
+
+        // repeating the last transaction of an odd list keeps the root (CVE-2012-2459)
+        if (nTx > 1 && nTx % 2) {
+            block.vtx.push_back(block.vtx.back());
+            uint256 merkleRoot2 = block.BuildMerkleTree(&fMutated);
+            BOOST_CHECK(fMutated);
+            BOOST_CHECK(merkleRoot1 == merkleRoot2);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pmt_coinbase_update)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 7, 17, 100, 513};
+
+    for (int n = 0; n < 7; n++) {
+        unsigned int nTx = nTxCounts[n];
+
+        CBlock block;
+        for (unsigned int j=0; j<nTx; j++) {
+            CMutableTransaction tx;
+            tx.nLockTime = rand();
+            block.vtx.push_back(CTransaction(tx));
+        }
+
+        // without a tree to update, the full tree is built
+        BOOST_CHECK(block.UpdateMerkleTreeCoinbase() == block.BuildMerkleTree());
+
+        for (int att = 0; att < 4; att++) {
+            CMutableTransaction txCoinbase(block.vtx[0]);
+            txCoinbase.nLockTime = rand();
+            block.vtx[0] = CTransaction(txCoinbase);
+
+            uint256 merkleRoot1 = block.UpdateMerkleTreeCoinbase();
+            std::vector<uint256> vMerkleTree1 = block.vMerkleTree;
+            uint256 merkleRoot2 = block.BuildMerkleTree();
+            BOOST_CHECK(merkleRoot1 == merkleRoot2);
+            BOOST_CHECK(vMerkleTree1 == block.vMerkleTree);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
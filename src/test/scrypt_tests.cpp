@@ -2,6 +2,7 @@
 
 #include "uint256.h"
 #include "util.h"
+#include "utilstrencodings.h"
 #include "crypto/scrypt.h"
 
 BOOST_AUTO_TEST_SUITE(scrypt_tests)
@@ -31,4 +32,52 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi_hashtest)
+{
+    // Hash a batch of headers through the multi-lane entry point, including
+    // partially filled batches, and compare against the single-lane kernel
+    scrypt_detect_avx2();
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<unsigned char> header = ParseHex("020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659");
+    std::vector<unsigned char> inputbytes;
+    for (int i = 0; i < SCRYPT_MULTI_WAYS; i++) {
+        header[76] = i; // vary the nonce
+        inputbytes.insert(inputbytes.end(), header.begin(), header.end());
+    }
+    for (int nCount = 1; nCount <= SCRYPT_MULTI_WAYS; nCount++) {
+        uint256 hashes[SCRYPT_MULTI_WAYS];
+        scrypt_1024_1_1_256_sp_multi((const char*)&inputbytes[0], BEGIN(hashes[0]), &scratchpad[0], nCount);
+        // Lane 0 keeps the original nonce
+        BOOST_CHECK_EQUAL(hashes[0].ToString(), "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806");
+        for (int i = 0; i < nCount; i++) {
+            uint256 scrypthash;
+            scrypt_1024_1_1_256_sp_generic((const char*)&inputbytes[i * 80], BEGIN(scrypthash), &scratchpad[0]);
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), scrypthash.ToString());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_midstate_hashtest)
+{
+    // Hash ranges of nonces from a midstate and compare against hashing each full header
+    scrypt_detect_avx2();
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<unsigned char> header = ParseHex("020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659");
+    const uint32_t nNonce = le32dec(&header[76]);
+    scrypt_midstate midstate;
+    scrypt_1024_1_1_256_midstate((const char*)&header[0], &midstate);
+    for (int nCount = 1; nCount <= SCRYPT_MULTI_WAYS; nCount++) {
+        uint256 hashes[SCRYPT_MULTI_WAYS];
+        scrypt_1024_1_1_256_sp_nonces(&midstate, nNonce, BEGIN(hashes[0]), &scratchpad[0], nCount);
+        BOOST_CHECK_EQUAL(hashes[0].ToString(), "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806");
+        for (int i = 0; i < nCount; i++) {
+            std::vector<unsigned char> input(header);
+            le32enc(&input[76], nNonce + i);
+            uint256 scrypthash;
+            scrypt_1024_1_1_256_sp_generic((const char*)&input[0], BEGIN(scrypthash), &scratchpad[0]);
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), scrypthash.ToString());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
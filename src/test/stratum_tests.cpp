@@ -0,0 +1,318 @@
+// Copyright (c) 2015 The Lavrovcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "main.h"
+#include "netbase.h"
+#include "pow.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_utils.h"
+#include "json/json_spirit_writer_template.h"
+
+using namespace json_spirit;
+
+namespace
+{
+//! A worker talking to the Stratum server over a local socket
+class CStratumTestClient
+{
+public:
+    SOCKET hSocket;
+    std::string strRecv;
+    //! Notifications received while waiting for a reply
+    std::vector<Object> vNotifications;
+
+    CStratumTestClient() : hSocket(INVALID_SOCKET) {}
+    ~CStratumTestClient()
+    {
+        CloseSocket(hSocket);
+    }
+
+    bool Connect(const CService& addr)
+    {
+        return ConnectSocket(addr, hSocket, 5000);
+    }
+
+    //! The next line from the server, or an empty object after ten seconds
+    Object Receive()
+    {
+        int64_t nStart = GetTimeMillis();
+        size_t nPos;
+        while ((nPos = strRecv.find('\n')) == std::string::npos) {
+            if (GetTimeMillis() - nStart > 10000)
+                return Object();
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 100000;
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            FD_SET(hSocket, &fdsetRecv);
+            if (select(hSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+                continue;
+            char pchBuf[0x1000];
+            int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+            if (nBytes <= 0)
+                return Object();
+            strRecv.append(pchBuf, nBytes);
+        }
+        Value value;
+        bool fRead = read_string(strRecv.substr(0, nPos), value);
+        strRecv.erase(0, nPos + 1);
+        if (!fRead || value.type() != obj_type)
+            return Object();
+        return value.get_obj();
+    }
+
+    //! Send a request and wait for its reply
+    Object Call(int nId, const std::string& strMethod, const Array& params)
+    {
+        Object request;
+        request.push_back(Pair("id", nId));
+        request.push_back(Pair("method", strMethod));
+        request.push_back(Pair("params", params));
+        std::string strLine = write_string(Value(request), false) + "\n";
+        BOOST_REQUIRE_EQUAL(send(hSocket, strLine.data(), strLine.size(), MSG_NOSIGNAL), (int)strLine.size());
+        while (true) {
+            Object reply = Receive();
+            BOOST_REQUIRE(!reply.empty());
+            const Value& id = find_value(reply, "id");
+            if (id.type() == int_type && id.get_int() == nId)
+                return reply;
+            vNotifications.push_back(reply);
+        }
+    }
+
+    //! The params of the next notification of the given method
+    Array WaitFor(const std::string& strMethod)
+    {
+        while (true) {
+            Object notification;
+            if (vNotifications.empty()) {
+                notification = Receive();
+                BOOST_REQUIRE(!notification.empty());
+            } else {
+                notification = vNotifications.front();
+                vNotifications.erase(vNotifications.begin());
+            }
+            if (find_value(notification, "method") == Value(strMethod))
+                return find_value(notification, "params").get_array();
+        }
+    }
+};
+
+//! A port that was free just now: the one picked for a bind to port 0
+unsigned short FreePort()
+{
+    CService addrBind("127.0.0.1", 0);
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    BOOST_REQUIRE(addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len));
+    SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    bool fBound = ::bind(hSocket, (struct sockaddr*)&sockaddr, len) != SOCKET_ERROR &&
+                  getsockname(hSocket, (struct sockaddr*)&sockaddr, &len) != SOCKET_ERROR &&
+                  addrBind.SetSockAddr((const struct sockaddr*)&sockaddr);
+    CloseSocket(hSocket);
+    BOOST_REQUIRE(fBound);
+    return addrBind.GetPort();
+}
+
+//! The submit params for a share of the job in notify
+Array Share(const Array& notify, const std::vector<unsigned char>& vExtraNonce2, uint32_t nTime, uint32_t nNonce)
+{
+    Array params;
+    params.push_back("worker");
+    params.push_back(notify[0]);
+    params.push_back(HexStr(vExtraNonce2));
+    params.push_back(strprintf("%08x", nTime));
+    params.push_back(strprintf("%08x", nNonce));
+    return params;
+}
+
+//! The header a worker hashes for the job in notify, built the way mining software does it
+CBlockHeader ShareHeader(const Array& notify, const std::vector<unsigned char>& vExtraNonce1, const std::vector<unsigned char>& vExtraNonce2, uint32_t nTime, uint32_t nNonce)
+{
+    std::vector<unsigned char> vCoinbase = ParseHex(notify[2].get_str());
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce1.begin(), vExtraNonce1.end());
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce2.begin(), vExtraNonce2.end());
+    std::vector<unsigned char> vCoinbase2 = ParseHex(notify[3].get_str());
+    vCoinbase.insert(vCoinbase.end(), vCoinbase2.begin(), vCoinbase2.end());
+
+    CBlockHeader header;
+    header.hashMerkleRoot = Hash(vCoinbase.begin(), vCoinbase.end());
+    BOOST_FOREACH(const Value& branch, notify[4].get_array()) {
+        std::vector<unsigned char> vBranch = ParseHex(branch.get_str());
+        header.hashMerkleRoot = Hash(BEGIN(header.hashMerkleRoot), END(header.hashMerkleRoot), vBranch.begin(), vBranch.end());
+    }
+    std::vector<unsigned char> vPrev = ParseHex(notify[1].get_str());
+    for (int i = 0; i < 32; i += 4)
+        for (int j = 0; j < 4; j++)
+            BEGIN(header.hashPrevBlock)[i + j] = vPrev[i + 3 - j];
+    header.nVersion = ReadBE32(&ParseHex(notify[5].get_str())[0]);
+    header.nBits = ReadBE32(&ParseHex(notify[6].get_str())[0]);
+    header.nTime = nTime;
+    header.nNonce = nNonce;
+    return header;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(stratum_tests)
+
+BOOST_AUTO_TEST_CASE(stratum_job_merkle)
+{
+    for (unsigned int nTx = 1; nTx <= 9; nTx++) {
+        CBlock block;
+        block.nVersion = 2;
+        block.nBits = 0x1e0ffff0;
+
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nValue = 50 * COIN;
+        txCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(txCoinbase);
+        for (unsigned int i = 1; i < nTx; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = GetRandHash();
+            tx.vin[0].prevout.n = i;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = i;
+            block.vtx.push_back(tx);
+        }
+
+        int nHeight = 100 + nTx * 1000;
+        CStratumJob job("1", block, NULL, nHeight);
+        BOOST_CHECK_EQUAL(job.vMerkleBranch.size(), job.block.GetMerkleBranch(0).size());
+
+        std::vector<unsigned char> vExtraNonce1(STRATUM_EXTRANONCE1_SIZE, 0x11);
+        std::vector<unsigned char> vExtraNonce2(STRATUM_EXTRANONCE2_SIZE);
+        for (unsigned int i = 0; i < vExtraNonce2.size(); i++)
+            vExtraNonce2[i] = i + nTx;
+
+        CBlock blockSolved = job.GetBlock(vExtraNonce1, vExtraNonce2, 1234567890, 42);
+        BOOST_CHECK_EQUAL(blockSolved.vtx.size(), nTx);
+        BOOST_CHECK_EQUAL(blockSolved.nTime, 1234567890U);
+        BOOST_CHECK_EQUAL(blockSolved.nNonce, 42U);
+        BOOST_CHECK(blockSolved.vtx[0].vout == block.vtx[0].vout);
+
+        // The merkle root from the branch matches a full rebuild
+        uint256 hashMerkleRoot = blockSolved.hashMerkleRoot;
+        BOOST_CHECK(hashMerkleRoot == blockSolved.BuildMerkleTree());
+
+        // The coinbase starts with the height, then pushes both extra nonces
+        std::vector<unsigned char> vExtraNonce(vExtraNonce1);
+        vExtraNonce.insert(vExtraNonce.end(), vExtraNonce2.begin(), vExtraNonce2.end());
+        CScript scriptExpected = (CScript() << nHeight) << vExtraNonce;
+        const CScript& scriptSig = blockSolved.vtx[0].vin[0].scriptSig;
+        BOOST_CHECK(scriptSig.size() >= scriptExpected.size());
+        BOOST_CHECK(std::equal(scriptExpected.begin(), scriptExpected.end(), scriptSig.begin()));
+    }
+}
+
+// A worker subscribes, authorizes and submits a share twice, then again once its job went stale
+BOOST_AUTO_TEST_CASE(stratum_server)
+{
+    // The job is the same on every run: an empty template on genesis at a fixed time,
+    // paying to a fixed address, and the first extra nonce handed out
+    int64_t nTime = Params().GenesisBlock().GetBlockTime() + 60 * 60;
+    SetMockTime(nTime);
+    mapArgs["-stratumaddress"] = CBitcoinAddress(CKeyID(uint160(0))).ToString();
+    unsigned short nPort = FreePort();
+    mapArgs["-stratumport"] = strprintf("%u", nPort);
+    boost::thread_group threadGroup;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(StartStratumServer(threadGroup, strError), strError);
+
+    CStratumTestClient client;
+    BOOST_REQUIRE(client.Connect(CService("127.0.0.1", nPort)));
+    Object reply = client.Call(1, "mining.subscribe", Array());
+    BOOST_CHECK(find_value(reply, "error").is_null());
+    const Array& subscribe = find_value(reply, "result").get_array();
+    BOOST_REQUIRE_EQUAL(subscribe.size(), 3U);
+    std::vector<unsigned char> vExtraNonce1 = ParseHex(subscribe[1].get_str());
+    BOOST_CHECK_EQUAL(vExtraNonce1.size(), STRATUM_EXTRANONCE1_SIZE);
+    BOOST_CHECK_EQUAL(subscribe[2].get_int(), (int)STRATUM_EXTRANONCE2_SIZE);
+    BOOST_CHECK_EQUAL(client.WaitFor("mining.set_difficulty")[0].get_int(), 1);
+    Array notify = client.WaitFor("mining.notify");
+    BOOST_REQUIRE_EQUAL(notify.size(), 9U);
+    BOOST_CHECK(notify[8].get_bool());
+
+    Array authorize;
+    authorize.push_back("worker");
+    authorize.push_back("x");
+    reply = client.Call(2, "mining.authorize", authorize);
+    BOOST_CHECK(find_value(reply, "result").get_bool());
+
+    // Look for a share that isn't a block, and a nonce that isn't even a share.
+    // About one nonce in 2^17 hashes between the block and the share target.
+    std::vector<unsigned char> vExtraNonce2(STRATUM_EXTRANONCE2_SIZE, 0);
+    uint32_t nShareTime = ReadBE32(&ParseHex(notify[7].get_str())[0]);
+    CBlockHeader header = ShareHeader(notify, vExtraNonce1, vExtraNonce2, nShareTime, 0);
+    uint256 hashShareTarget = uint256(0xffff) << 224;
+    uint32_t nShareNonce = 0, nLowNonce = 0;
+    bool fShare = false, fLow = false;
+    for (uint32_t nNonce = 0; nNonce < (1 << 22) && !fShare; nNonce++) {
+        header.nNonce = nNonce;
+        uint256 hash = header.GetPoWHash();
+        if (hash > hashShareTarget) {
+            if (!fLow)
+                nLowNonce = nNonce;
+            fLow = true;
+        } else if (!CheckProofOfWork(hash, header.nBits)) {
+            nShareNonce = nNonce;
+            fShare = true;
+        }
+    }
+    BOOST_REQUIRE(fShare && fLow);
+
+    reply = client.Call(3, "mining.submit", Share(notify, vExtraNonce2, nShareTime, nShareNonce));
+    BOOST_CHECK(find_value(reply, "result").get_bool());
+    BOOST_CHECK(find_value(reply, "error").is_null());
+
+    reply = client.Call(4, "mining.submit", Share(notify, vExtraNonce2, nShareTime, nShareNonce));
+    BOOST_CHECK(!find_value(reply, "result").get_bool());
+    BOOST_CHECK_EQUAL(find_value(reply, "error").get_array()[0].get_int(), 22);
+
+    reply = client.Call(5, "mining.submit", Share(notify, vExtraNonce2, nShareTime, nLowNonce));
+    BOOST_CHECK_EQUAL(find_value(reply, "error").get_array()[0].get_int(), 23);
+
+    // The mempool changing makes a new job every 30 seconds, older ones are dropped
+    for (unsigned int i = 0; i < MAX_STRATUM_JOBS; i++) {
+        nTime += 31;
+        SetMockTime(nTime);
+        mempool.AddTransactionsUpdated(1);
+        Array notifyNext = client.WaitFor("mining.notify");
+        BOOST_CHECK(notifyNext[0].get_str() != notify[0].get_str());
+        BOOST_CHECK(!notifyNext[8].get_bool());
+    }
+    reply = client.Call(6, "mining.submit", Share(notify, vExtraNonce2, nShareTime, nShareNonce));
+    BOOST_CHECK(!find_value(reply, "result").get_bool());
+    BOOST_CHECK_EQUAL(find_value(reply, "error").get_array()[0].get_int(), 21);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    mapArgs.erase("-stratumaddress");
+    mapArgs.erase("-stratumport");
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,11 @@
 
 #include "wallet.h"
 
+#include "main.h"
+#include "random.h"
+#include "txmempool.h"
+
+#include <list>
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -305,4 +310,124 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+// The balances counted from scratch, as the wallet did before caching them
+static CWalletBalance RecountBalances(const CWallet& w)
+{
+    CWalletBalance balance;
+    for (map<uint256, CWalletTx>::const_iterator it = w.mapWallet.begin(); it != w.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = it->second;
+        bool fTrusted = wtx.IsTrusted();
+        if (fTrusted)
+            balance.nTrusted += wtx.GetAvailableCredit(false);
+        if (!IsFinalTx(wtx) || (!fTrusted && wtx.GetDepthInMainChain() == 0))
+            balance.nUnconfirmed += wtx.GetAvailableCredit(false);
+        balance.nImmature += wtx.GetImmatureCredit(false);
+    }
+    return balance;
+}
+
+static void CheckBalances(const CWallet& w)
+{
+    CWalletBalance balanceCached = w.GetBalances();
+    CWalletBalance balanceCounted = RecountBalances(w);
+    BOOST_CHECK_EQUAL(balanceCached.nTrusted, balanceCounted.nTrusted);
+    BOOST_CHECK_EQUAL(balanceCached.nUnconfirmed, balanceCounted.nUnconfirmed);
+    BOOST_CHECK_EQUAL(balanceCached.nImmature, balanceCounted.nImmature);
+}
+
+// Blocks linked into the block index but never stored, for wallet transactions to be confirmed in
+static std::list<CBlockIndex> lBalanceBlocks;
+
+static CBlockIndex* AddBalanceBlock(CBlockIndex* pindexPrev, CBlock& block)
+{
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nNonce = lBalanceBlocks.size();
+    block.BuildMerkleTree();
+    lBalanceBlocks.push_back(CBlockIndex(block));
+    CBlockIndex* pindex = &lBalanceBlocks.back();
+    pindex->pprev = pindexPrev;
+    pindex->nHeight = pindexPrev->nHeight + 1;
+    pindex->phashBlock = &mapBlockIndex.insert(make_pair(block.GetHash(), pindex)).first->first;
+    return pindex;
+}
+
+static CMutableTransaction BalanceTx(const CScript& scriptPubKey, const CAmount& nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(balance_cache_tests)
+{
+    CWallet walletBalances("wallet_balances_test.dat");
+    CKey key;
+    key.MakeNewKey(true);
+    walletBalances.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, walletBalances.cs_wallet);
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    CheckBalances(walletBalances);
+
+    // A confirmed payment, an immature coinbase, one in the mempool and a non-final one
+    CBlock blockPayment;
+    blockPayment.vtx.push_back(BalanceTx(scriptPubKey, 10 * COIN));
+    CBlockIndex* pindexPayment = AddBalanceBlock(pindexGenesis, blockPayment);
+    CBlock blockCoinbase;
+    CMutableTransaction txCoinbase = BalanceTx(scriptPubKey, 50 * COIN);
+    txCoinbase.vin[0].prevout.SetNull();
+    blockCoinbase.vtx.push_back(txCoinbase);
+    CBlockIndex* pindexCoinbase = AddBalanceBlock(pindexPayment, blockCoinbase);
+    chainActive.SetTip(pindexCoinbase);
+    CTransaction txMempool = BalanceTx(scriptPubKey, 3 * COIN);
+    mempool.addUnchecked(txMempool.GetHash(), CTxMemPoolEntry(txMempool, 0, 0, 0.0, 1));
+    CMutableTransaction txNonFinal = BalanceTx(scriptPubKey, 1 * COIN);
+    txNonFinal.nLockTime = 1000;
+    txNonFinal.vin[0].nSequence = 0;
+
+    walletBalances.SyncTransaction(blockPayment.vtx[0], &blockPayment);
+    CheckBalances(walletBalances);
+    walletBalances.SyncTransaction(blockCoinbase.vtx[0], &blockCoinbase);
+    CheckBalances(walletBalances);
+    walletBalances.SyncTransaction(txMempool, NULL);
+    CheckBalances(walletBalances);
+    walletBalances.SyncTransaction(txNonFinal, NULL);
+    CheckBalances(walletBalances);
+    BOOST_CHECK_EQUAL(walletBalances.GetBalance(), 10 * COIN);
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), 4 * COIN);
+    BOOST_CHECK_EQUAL(walletBalances.GetImmatureBalance(), 50 * COIN);
+
+    // The tip moving on without the wallet hearing about it
+    CBlock blockEmpty;
+    chainActive.SetTip(AddBalanceBlock(pindexCoinbase, blockEmpty));
+    CheckBalances(walletBalances);
+
+    walletBalances.MarkDirty();
+    CheckBalances(walletBalances);
+
+    // A reorganization to a longer chain without the two blocks
+    CBlockIndex* pindexFork = pindexGenesis;
+    for (int i = 0; i < 4; i++) {
+        CBlock block;
+        pindexFork = AddBalanceBlock(pindexFork, block);
+    }
+    chainActive.SetTip(pindexFork);
+    CheckBalances(walletBalances);
+    BOOST_CHECK_EQUAL(walletBalances.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(walletBalances.GetImmatureBalance(), 0);
+
+    std::list<CTransaction> removed;
+    mempool.remove(txMempool, removed);
+    chainActive.SetTip(pindexGenesis);
+    BOOST_FOREACH(const CBlockIndex& index, lBalanceBlocks)
+        mapBlockIndex.erase(index.GetBlockHash());
+    lBalanceBlocks.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
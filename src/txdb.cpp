@@ -6,19 +6,111 @@
 #include "txdb.h"
 
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+/**
+ * The coin database keeps one 'C' record per unspent output, keyed by txid
+ * and output index, and one 'T' record per transaction with unspent outputs
+ * for what they share, and how many outputs there may be. Spending an output
+ * erases its record, and only the last one of a transaction touches the 'T'
+ * record too. Databases with a 'c'
+ * record per transaction (the whole CCoins) are converted by Upgrade().
+ */
+namespace {
+
+/** Key of the record of one unspent output. The index is stored big endian, so a transaction's outputs are adjacent and in order. */
+struct CCoinsOutputKey
+{
+    uint256 txid;
+    uint32_t n;
+
+    CCoinsOutputKey() : n(0) {}
+    CCoinsOutputKey(const uint256 &txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        unsigned char vchIndex[4] = {(unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n};
+        READWRITE(FLATDATA(vchIndex));
+        if (ser_action.ForRead())
+            n = ((uint32_t)vchIndex[0] << 24) | ((uint32_t)vchIndex[1] << 16) | ((uint32_t)vchIndex[2] << 8) | vchIndex[3];
+    }
+};
+
+/** What the unspent outputs of a transaction have in common. All of them have an index below nOutputs. */
+struct CCoinsHeader
+{
+    int nTxVersion;
+    int nHeight;
+    bool fCoinBase;
+    unsigned int nOutputs;
+
+    CCoinsHeader() : nTxVersion(0), nHeight(0), fCoinBase(false), nOutputs(0) {}
+    explicit CCoinsHeader(const CCoins &coins) : nTxVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), nOutputs(coins.vout.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nTxVersion));
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+        }
+        READWRITE(VARINT(nOutputs));
+    }
+};
+
+/**
+ * Transactions with up to this many outputs are read with a lookup per
+ * output, larger ones with an iterator over their records. Most have one or
+ * two, for which lookups take about a third less time than seeking.
+ */
+static const unsigned int MAX_COINS_POINT_READS = 4;
+
+} // anon namespace
+
+/**
+ * Write the changes of a cache entry: the outputs that are spent or unspent
+ * now but weren't in the database, which holds vBaseUnspent of them (nothing
+ * if the entry is FRESH). Unspent outputs never change otherwise, as
+ * transactions that still have unspent outputs can't be created again
+ * (BIP30). What they share only changes with the height, when a transaction
+ * was spent entirely and then created again, and the number of outputs when
+ * outputs past the last unspent one are unspent again.
+ */
+void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoinsCacheEntry &entry) {
+    const CCoins &coins = entry.coins;
+    bool fFresh = entry.flags & CCoinsCacheEntry::FRESH;
+    unsigned int nOutputs = std::max(coins.vout.size(), fFresh ? 0 : entry.vBaseUnspent.size() * 8);
+    unsigned int nHad = 0;
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        bool fHad = !fFresh && entry.IsBaseUnspent(i);
+        bool fHas = coins.IsAvailable(i);
+        if (fHad)
+            nHad = i + 1;
+        if (fHas && !fHad)
+            batch.Write(make_pair('C', CCoinsOutputKey(hash, i)), CTxOutCompressor(REF(coins.vout[i])));
+        else if (fHad && !fHas)
+            batch.Erase(make_pair('C', CCoinsOutputKey(hash, i)));
+    }
+    // The 'T' record allows for at least nHad outputs
+    if (coins.IsPruned() && nHad)
+        batch.Erase(make_pair('T', hash));
+    else if (!coins.IsPruned() && (!nHad || coins.nHeight != entry.nBaseHeight || coins.vout.size() > nHad))
+        batch.Write(make_pair('T', hash), CCoinsHeader(coins));
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
@@ -29,11 +121,56 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair('c', txid), coins);
+    // The 'T' record is looked up first, so the bloom filter answers for
+    // transactions that aren't there
+    CCoinsHeader header;
+    if (!db.Read(make_pair('T', txid), header))
+        return false;
+    coins.Clear();
+    coins.nVersion = header.nTxVersion;
+    coins.nHeight = header.nHeight;
+    coins.fCoinBase = header.fCoinBase;
+    coins.vout.resize(header.nOutputs);
+
+    if (header.nOutputs <= MAX_COINS_POINT_READS) {
+        for (unsigned int i = 0; i < header.nOutputs; i++) {
+            CTxOutCompressor out(coins.vout[i]);
+            db.Read(make_pair('C', CCoinsOutputKey(txid, i)), out);
+        }
+        coins.Cleanup();
+        return !coins.IsPruned();
+    }
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewReadIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('C', CCoinsOutputKey(txid, 0));
+    pcursor->Seek(ssKeySet.str());
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CCoinsOutputKey key;
+            ssKey >> chType;
+            if (chType != 'C')
+                break;
+            ssKey >> key;
+            if (key.txid != txid || key.n >= coins.vout.size())
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> REF(CTxOutCompressor(coins.vout[key.n]));
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    HandleError(pcursor->status());
+    coins.Cleanup();
+    return !coins.IsPruned();
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(make_pair('T', txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -43,18 +180,19 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            BatchWriteCoins(batch, it->first, it->second);
             changed++;
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase)
+            mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
@@ -63,6 +201,252 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
+CCoinsViewPrefetch::~CCoinsViewPrefetch() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    fStop = true;
+    condQueue.notify_all();
+    while (nThreads > 0)
+        condThreads.wait(lock);
+}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        std::map<uint256, CCoins>::iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end()) {
+            nHits++;
+            coins.swap(it->second);
+            mapPrefetched.erase(it);
+            return true;
+        }
+        nMisses++;
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (mapPrefetched.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
+            mapPrefetched.erase(it->first);
+        nWrites++;
+        LogPrint("coindb", "Prefetched coins: %u hits, %u misses, %u unused\n", nHits, nMisses, mapPrefetched.size());
+    }
+    bool fOk = base->BatchWrite(mapCoins, hashBlock, fErase);
+    // Reads that started while the write was going on may have seen either version
+    boost::unique_lock<boost::mutex> lock(cs);
+    nWrites++;
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256>& vTxid) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (mapPrefetched.size() >= MAX_PREFETCHED_COINS) {
+        // Whatever was never asked for (e.g. for blocks that didn't make it
+        // into the active chain) is given up on
+        LogPrint("coindb", "Dropping %u unused prefetched coins\n", mapPrefetched.size());
+        mapPrefetched.clear();
+    }
+    BOOST_FOREACH(const uint256& txid, vTxid) {
+        if (setQueued.size() + mapPrefetched.size() >= MAX_PREFETCHED_COINS)
+            break;
+        if (mapPrefetched.count(txid) || !setQueued.insert(txid).second)
+            continue;
+        queue.push_back(txid);
+    }
+    condQueue.notify_all();
+}
+
+bool CCoinsViewPrefetch::IsIdle() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return setQueued.empty();
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch() {
+    RenameThread("lavrovcoin-prefetch");
+    boost::unique_lock<boost::mutex> lock(cs);
+    nThreads++;
+    try {
+        while (true) {
+            while (queue.empty() && !fStop)
+                condQueue.wait(lock);
+            if (fStop)
+                break;
+            uint256 txid = queue.front();
+            queue.pop_front();
+            uint64_t nWritesBefore = nWrites;
+
+            CCoins coins;
+            bool fFound;
+            lock.unlock();
+            fFound = base->GetCoins(txid, coins);
+            lock.lock();
+
+            setQueued.erase(txid);
+            // A write that was in progress, or started, while we were reading
+            // may have changed the entry
+            if (fFound && nWritesBefore % 2 == 0 && nWrites == nWritesBefore)
+                mapPrefetched[txid].swap(coins);
+        }
+    } catch (const boost::thread_interrupted&) {
+        nThreads--;
+        condThreads.notify_all();
+        throw;
+    }
+    nThreads--;
+    condThreads.notify_all();
+}
+
+CCoinsViewWriteBehind::~CCoinsViewWriteBehind() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    fStop = true;
+    condWork.notify_all();
+    while (fRunning)
+        condDone.wait(lock);
+}
+
+void CCoinsViewWriteBehind::WaitPending(boost::unique_lock<boost::mutex>& lock) const {
+    while (fPending)
+        condDone.wait(lock);
+}
+
+bool CCoinsViewWriteBehind::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapPending.find(txid);
+        if (it != mapPending.end()) {
+            // Pruned entries are about to be erased from the database
+            coins = it->second.coins;
+            return !coins.IsPruned();
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewWriteBehind::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapPending.find(txid);
+        if (it != mapPending.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending && hashPending != uint256(0))
+            return hashPending;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitPending(lock);
+    if (fFailed)
+        return false;
+    if (!fRunning) {
+        lock.unlock();
+        return base->BatchWrite(mapCoins, hashBlock, fErase);
+    }
+    // Only the unspent coins are copied; the caller keeps no use for the rest
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsCacheEntry& entry = mapPending[it->first];
+        if (fErase || it->second.coins.IsPruned())
+            entry.coins.swap(it->second.coins);
+        else
+            entry.coins = it->second.coins;
+        entry.vBaseUnspent.swap(it->second.vBaseUnspent);
+        entry.flags = it->second.flags;
+        entry.nBaseHeight = it->second.nBaseHeight;
+        nPendingUsage += entry.coins.DynamicMemoryUsage() + memusage::DynamicUsage(entry.vBaseUnspent);
+    }
+    nPendingUsage += memusage::DynamicUsage(mapPending);
+    if (fErase)
+        mapCoins.clear();
+    hashPending = hashBlock;
+    fPending = true;
+    condWork.notify_all();
+    return true;
+}
+
+bool CCoinsViewWriteBehind::GetStats(CCoinsStats &stats) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        WaitPending(lock);
+    }
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewWriteBehind::Wait() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitPending(lock);
+    return !fFailed;
+}
+
+size_t CCoinsViewWriteBehind::DynamicMemoryUsage() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nPendingUsage;
+}
+
+bool CCoinsViewWriteBehind::IsRunning() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return fRunning;
+}
+
+void CCoinsViewWriteBehind::ThreadWrite() {
+    RenameThread("lavrovcoin-coinwrite");
+    boost::unique_lock<boost::mutex> lock(cs);
+    fRunning = true;
+    try {
+        while (true) {
+            while (!fPending && !fStop)
+                condWork.wait(lock);
+            if (!fPending)
+                break;
+
+            // Nothing changes mapPending until the write is done, so readers
+            // keep using it in the meantime
+            lock.unlock();
+            int64_t nStart = GetTimeMicros();
+            bool fOk;
+            try {
+                fOk = base->BatchWrite(mapPending, hashPending, false);
+            } catch (const std::exception& e) {
+                LogPrintf("Error writing to coin database: %s\n", e.what());
+                fOk = false;
+            }
+            LogPrint("bench", "- Write coin database in the background: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+            lock.lock();
+
+            fFailed |= !fOk;
+            mapPending.clear();
+            nPendingUsage = 0;
+            fPending = false;
+            condDone.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        fRunning = false;
+        condDone.notify_all();
+        throw;
+    }
+    fRunning = false;
+    condDone.notify_all();
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -104,12 +488,18 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('C', CCoinsOutputKey());
+    pcursor->Seek(ssKeySet.str());
 
+    // The hash covers the same data, in the same order, as it did when the
+    // database had a record per transaction
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 txhash;
+    bool fInTx = false;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -117,41 +507,108 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
+            if (chType != 'C')
+                break;
+            CCoinsOutputKey key;
+            ssKey >> key;
+            if (!fInTx || key.txid != txhash) {
+                if (fInTx)
+                    ss << VARINT(0);
+                txhash = key.txid;
+                fInTx = true;
+                CCoinsHeader header;
+                if (!db.Read(make_pair('T', txhash), header))
+                    return error("%s : no transaction record for %s", __func__, txhash.ToString());
                 ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
+                ss << VARINT(header.nTxVersion);
+                ss << (header.fCoinBase ? 'c' : 'n');
+                ss << VARINT(header.nHeight);
                 stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                stats.nSerializedSize += 33 + ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION);
             }
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CTxOut out;
+            ssValue >> REF(CTxOutCompressor(out));
+            stats.nTransactionOutputs++;
+            ss << VARINT(key.n+1);
+            ss << out;
+            nTotalAmount += out.nValue;
+            stats.nSerializedSize += slKey.size() + slValue.size();
             pcursor->Next();
         } catch (std::exception &e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (fInTx)
+        ss << VARINT(0);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('c', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    // Every batch replaces the records it converts, so an interrupted upgrade
+    // continues where it stopped at the next start
+    LogPrintf("Upgrading the coin database to a record per unspent output...\n");
+    uiInterface.ShowProgress(_("Upgrading coin database..."), 0);
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    size_t nTotal = 0;
+    int nReported = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        CCoinsCacheEntry entry;
+        uint256 txid;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'c')
+                break;
+            ssKey >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> entry.coins;
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        BatchWriteCoins(batch, txid, entry);
+        batch.Erase(make_pair('c', txid));
+        nTotal++;
+        if (++nBatch == 10000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+            nBatch = 0;
+            // Keys are in txid order, so the first byte says how far along we are
+            int nDone = *txid.begin() * 100 / 256;
+            if (nDone > nReported) {
+                nReported = nDone;
+                LogPrintf("Upgrading the coin database... %d%% (%u transactions)\n", nDone, nTotal);
+                uiInterface.ShowProgress(_("Upgrading coin database..."), std::max(1, std::min(99, nDone)));
+            }
+        }
+        pcursor->Next();
+    }
+    HandleError(pcursor->status());
+    if (!db.WriteBatch(batch, true))
+        return false;
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Upgraded %u transactions in the coin database\n", nTotal);
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
@@ -218,6 +675,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 // While it is technically feasible to verify the PoW, doing so takes several minutes as it
                 // requires recomputing every PoW hash during every Lavrovcoin startup.
                 // We opt instead to simply trust the data that is on your local disk.
+                // Use -auditblockindex to re-verify it in the background after startup.
                 //if (!CheckProofOfWork(pindexNew->GetBlockPoWHash(), pindexNew->nBits))
                 //    return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
 
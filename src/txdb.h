@@ -9,11 +9,16 @@
 #include "leveldbwrapper.h"
 #include "main.h"
 
+#include <deque>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 class CCoins;
 class uint256;
 
@@ -23,6 +28,10 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -prefetchthreads default
+static const int DEFAULT_PREFETCH_THREADS = 4;
+//! Number of prefetched transactions kept at most
+static const unsigned int MAX_PREFETCHED_COINS = 100000;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -35,8 +44,111 @@ public:
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Convert a database with a record per transaction to the current format
+    bool Upgrade();
+};
+
+/**
+ * CCoinsView layer that holds coins read from the database ahead of time, by
+ * background threads, for the inputs of blocks that are about to be
+ * connected. Each prefetched entry is handed out once, as the cache above
+ * keeps it from then on. Writes drop the entries they overwrite, and
+ * discard reads that were in flight.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    //! Protects everything below
+    mutable boost::mutex cs;
+    //! Prefetch threads wait on this for work
+    boost::condition_variable condQueue;
+    //! Signalled when a prefetch thread exits
+    boost::condition_variable condThreads;
+    mutable std::map<uint256, CCoins> mapPrefetched;
+    std::deque<uint256> queue;
+    std::set<uint256> setQueued;
+    //! Incremented before and after every BatchWrite, so odd while one is in progress
+    uint64_t nWrites;
+    int nThreads;
+    bool fStop;
+    mutable uint64_t nHits;
+    mutable uint64_t nMisses;
+
+public:
+    CCoinsViewPrefetch(CCoinsView* view) : CCoinsViewBacked(view), nWrites(0), nThreads(0), fStop(false), nHits(0), nMisses(0) {}
+    //! Waits for the prefetch threads to exit
+    ~CCoinsViewPrefetch();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+
+    //! Queue the transactions whose outputs are spent by the given inputs for reading
+    void Prefetch(const std::vector<uint256>& vTxid);
+
+    //! Whether everything queued has been read
+    bool IsIdle() const;
+
+    //! Run a prefetch thread, reading queued transactions until shut down
+    void ThreadPrefetch();
+};
+
+/**
+ * CCoinsView layer that writes to the database in the background. A write
+ * hands over a copy of the modified entries, and returns while the writer
+ * thread commits them, with the best block, in a single batch. Reads see
+ * what is being written until it is committed. Writes are done one at a
+ * time, so a write waits for the previous one to complete, and without a
+ * writer thread they are done right away.
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    //! Protects everything below
+    mutable boost::mutex cs;
+    //! The writer thread waits on this for work
+    boost::condition_variable condWork;
+    //! Signalled when a write completes, and when the writer thread exits
+    mutable boost::condition_variable condDone;
+    //! The entries being written, and the best block that goes with them
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fPending;
+    //! Memory used by mapPending, in bytes
+    size_t nPendingUsage;
+    //! Set once a write failed; later writes fail as well
+    bool fFailed;
+    bool fRunning;
+    bool fStop;
+
+    //! Wait until nothing is being written. Requires cs to be held.
+    void WaitPending(boost::unique_lock<boost::mutex>& lock) const;
+
+public:
+    CCoinsViewWriteBehind(CCoinsView* view) : CCoinsViewBacked(view), fPending(false), nPendingUsage(0), fFailed(false), fRunning(false), fStop(false) {}
+    //! Waits for the writer thread to exit
+    ~CCoinsViewWriteBehind();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Wait until what was handed over has been written, and return whether all writes succeeded
+    bool Wait();
+
+    //! Memory held by what is being written, in bytes
+    size_t DynamicMemoryUsage() const;
+
+    //! Whether the writer thread runs, so writes are done in the background
+    bool IsRunning() const;
+
+    //! Run the writer thread, until shut down
+    void ThreadWrite();
 };
 
 /** Access to the block database (blocks/index/) */
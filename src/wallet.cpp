@@ -553,17 +553,27 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        fBalanceCacheValid = false;
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
     }
 }
 
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (fBalanceCacheValid)
+        setBalanceDirty.insert(hash);
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 {
     uint256 hash = wtxIn.GetHash();
 
     if (fFromLoadWallet)
     {
+        // Overwriting the entry loses its counted share of the balances
+        fBalanceCacheValid = false;
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
@@ -724,7 +734,10 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            fBalanceCacheValid = false;
+        }
     }
     return;
 }
@@ -1061,49 +1074,81 @@ void CWallet::ResendWalletTransactions()
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::CountBalance(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_wallet);
+    if (wtx.fBalanceCounted)
+        balanceCached -= wtx.balanceCounted;
+
+    CWalletBalance balance;
+    bool fFinal = IsFinalTx(wtx);
+    bool fTrusted = wtx.IsTrusted();
+    int nDepth = wtx.GetDepthInMainChain();
+    if (fTrusted)
+        balance.nTrusted = wtx.GetAvailableCredit();
+    if (!fFinal || (!fTrusted && nDepth == 0))
+        balance.nUnconfirmed = wtx.GetAvailableCredit();
+    balance.nImmature = wtx.GetImmatureCredit();
+    balance.nNonFinal = fFinal ? 0 : 1;
+
+    balanceCached += balance;
+    wtx.balanceCounted = balance;
+    wtx.fBalanceCounted = true;
+
+    // Unconfirmed, conflicted, non-final and immature transactions can change
+    // state when the tip moves without the wallet being told about them
+    if (nDepth < 1 || !fFinal || wtx.GetBlocksToMaturity() > 0)
+        setBalanceVolatile.insert(wtx.GetHash());
+    else
+        setBalanceVolatile.erase(wtx.GetHash());
+}
+
+CWalletBalance CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+    if (!fBalanceCacheValid || pindexBalanceTip == NULL || !chainActive.Contains(pindexBalanceTip))
     {
-        LOCK2(cs_main, cs_wallet);
+        // Depths may have dropped anywhere after a reorganization, count everything
+        balanceCached = CWalletBalance();
+        setBalanceVolatile.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            it->second.fBalanceCounted = false;
+            CountBalance(it->second);
         }
+        fBalanceCacheValid = true;
     }
+    else
+    {
+        // Extending the chain only affects the volatile transactions, as does
+        // time passing for the non-final ones
+        if (pindexBalanceTip != chainActive.Tip() || balanceCached.nNonFinal > 0)
+            setBalanceDirty.insert(setBalanceVolatile.begin(), setBalanceVolatile.end());
+        BOOST_FOREACH(const uint256& hash, setBalanceDirty)
+        {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it != mapWallet.end())
+                CountBalance(it->second);
+        }
+    }
+    setBalanceDirty.clear();
+    pindexBalanceTip = chainActive.Tip();
+    return balanceCached;
+}
 
-    return nTotal;
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
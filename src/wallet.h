@@ -105,6 +105,35 @@ public:
     StringMap destdata;
 };
 
+/** Balances of a wallet, or the share a single transaction contributes to them */
+struct CWalletBalance
+{
+    CAmount nTrusted;       //! see CWallet::GetBalance()
+    CAmount nUnconfirmed;   //! see CWallet::GetUnconfirmedBalance()
+    CAmount nImmature;      //! see CWallet::GetImmatureBalance()
+    int nNonFinal;          //! number of non-final transactions counted
+
+    CWalletBalance() : nTrusted(0), nUnconfirmed(0), nImmature(0), nNonFinal(0) {}
+
+    CWalletBalance& operator+=(const CWalletBalance& b)
+    {
+        nTrusted += b.nTrusted;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nNonFinal += b.nNonFinal;
+        return *this;
+    }
+
+    CWalletBalance& operator-=(const CWalletBalance& b)
+    {
+        nTrusted -= b.nTrusted;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nNonFinal -= b.nNonFinal;
+        return *this;
+    }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -137,6 +166,19 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Balances kept up to date incrementally, see GetBalances().
+     * Each transaction's share is stored in it (CWalletTx::balanceCounted),
+     * only transactions marked dirty since the last query and those whose share
+     * depends on the chain height (setBalanceVolatile) are recounted.
+     */
+    mutable CWalletBalance balanceCached;
+    mutable bool fBalanceCacheValid;
+    mutable const CBlockIndex* pindexBalanceTip;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalanceVolatile;
+    void CountBalance(const CWalletTx& wtx) const;
+
 public:
     /*
      * Main wallet lock.
@@ -187,6 +229,8 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fBalanceCacheValid = false;
+        pindexBalanceTip = NULL;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -277,6 +321,8 @@ public:
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
     void MarkDirty();
+    //! Recount a transaction's share of the cached balances on the next query
+    void MarkBalanceDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet=false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
@@ -284,6 +330,7 @@ public:
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
+    CWalletBalance GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -591,6 +638,9 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    //! share of the wallet's cached balances counted for this transaction
+    mutable bool fBalanceCounted;
+    mutable CWalletBalance balanceCounted;
 
     CWalletTx()
     {
@@ -640,6 +690,8 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        fBalanceCounted = false;
+        balanceCounted = CWalletBalance();
         nOrderPos = -1;
     }
 
@@ -698,6 +750,8 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        if (pwallet)
+            pwallet->MarkBalanceDirty(GetHash());
     }
 
     void BindWallet(CWallet *pwalletIn)